@@ -0,0 +1,120 @@
+/*
+ * Copyright (c) 2020-2023 Estonian Information System Authority
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#pragma once
+
+#include "pcsc-cpp.hpp"
+#include "comp_winscard.hpp"
+
+namespace pcsc_cpp
+{
+
+/**
+ * PC/SC API function table, every PC/SC call of the library goes through the backend of the
+ * context. The members are named after the SCard* functions and have their signatures, so the
+ * platform functions can be used directly. Context and card handles are opaque to the library.
+ */
+struct PcscBackend
+{
+    decltype(&SCardEstablishContext) EstablishContext;
+    decltype(&SCardReleaseContext) ReleaseContext;
+    decltype(&SCardIsValidContext) IsValidContext;
+    decltype(&SCardListReaders) ListReaders;
+    decltype(&SCardGetStatusChange) GetStatusChange;
+    decltype(&SCardCancel) Cancel;
+    decltype(&SCardConnect) Connect;
+    decltype(&SCardDisconnect) Disconnect;
+    decltype(&SCardBeginTransaction) BeginTransaction;
+    decltype(&SCardEndTransaction) EndTransaction;
+    decltype(&SCardStatus) Status;
+    decltype(&SCardTransmit) Transmit;
+    decltype(&SCardControl) Control;
+};
+
+/** The platform PC/SC service. */
+const PcscBackend& systemPcscBackend();
+
+/**
+ * The backend of contexts that are created without an explicit backend, including the contexts
+ * of listReaders(), ReaderMonitor and ReaderWorkerPool. Initially systemPcscBackend(), existing
+ * contexts keep their backend when it is changed.
+ */
+PcscBackend defaultPcscBackend();
+void setDefaultPcscBackend(const PcscBackend& backend);
+
+/** Elementary or dedicated file of an emulated card, see EmulatedCard. */
+struct EmulatedFile
+{
+    uint16_t id = 0;
+    bool isDedicated = false;
+    // DF name for selection by name, usually the application identifier.
+    byte_vector dfName;
+    // Contents of a transparent EF.
+    byte_vector content;
+    std::vector<EmulatedFile> children;
+
+    static EmulatedFile dedicated(uint16_t id, std::vector<EmulatedFile> children,
+                                  byte_vector dfName = {});
+    static EmulatedFile elementary(uint16_t id, byte_vector content);
+};
+
+/**
+ * Software card with an ISO/IEC 7816-4 file system that supports SELECT by file identifier, DF
+ * name and path, READ BINARY, UPDATE BINARY and GET RESPONSE.
+ *
+ * A T=0 card returns response data of case 4 commands with 61xx and GET RESPONSE and reports a
+ * wrong Le of case 2 commands with 6Cxx. A T=1 card returns the data directly and supports
+ * extended length APDUs when extendedLengthSupported is set.
+ *
+ * Every APDU takes apduOverhead plus the transfer time of the command and response bytes at
+ * baudRate bits per second, with 12 bit times per byte for T=0 and 11 for T=1. Zero baudRate
+ * disables the transfer time.
+ */
+struct EmulatedCard
+{
+    // Direct convention, T=1 and TCK.
+    byte_vector atr {0x3b, 0x80, 0x01, 0x81};
+    SmartCard::Protocol protocol = SmartCard::Protocol::T1;
+    bool extendedLengthSupported = false;
+    uint32_t baudRate = 0;
+    std::chrono::microseconds apduOverhead {0};
+    EmulatedFile masterFile = EmulatedFile::dedicated(0x3f00, {});
+};
+
+/**
+ * In-process backend that serves emulated readers and cards without the PC/SC service, so that
+ * card flows can be load-tested with hundreds of virtual readers on one host. The emulated
+ * readers are shared by all contexts of the backend in the process.
+ */
+const PcscBackend& emulatedPcscBackend();
+
+/**
+ * Insert the card into the emulated reader, the reader is added if it does not exist. A card that
+ * is already in the reader is removed first.
+ */
+void insertEmulatedCard(const string_t& readerName, EmulatedCard card);
+/** Remove the card from the emulated reader, connections to the card fail with a removed card. */
+void removeEmulatedCard(const string_t& readerName);
+/** Remove all emulated readers and cards. */
+void removeEmulatedReaders();
+
+} // namespace pcsc_cpp
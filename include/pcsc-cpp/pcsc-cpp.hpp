@@ -23,10 +23,19 @@
 #pragma once
 
 #include "flag-set-cpp/flag_set.hpp"
+#include "pcsc-cpp/small_byte_vector.hpp"
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <future>
 #include <memory>
+#include <optional>
+#include <type_traits>
 #include <vector>
 #include <limits>
+#include <map>
 
 // The rule of five (C++ Core guidelines C.21).
 #define PCSC_CPP_DISABLE_COPY_MOVE(Class)                                                          \
@@ -40,6 +49,10 @@ namespace pcsc_cpp
 
 using byte_type = unsigned char;
 using byte_vector = std::vector<byte_type>;
+/** Inline capacity that fits a whole short command APDU: header, Lc, 255 data bytes and Le. */
+constexpr size_t SHORT_APDU_MAX_SIZE = 261;
+/** APDU data storage, short APDU data stays inline and extended length data goes to the heap. */
+using apdu_byte_vector = small_byte_vector<SHORT_APDU_MAX_SIZE>;
 #ifdef _WIN32
 using string_t = std::wstring;
 #else
@@ -48,6 +61,9 @@ using string_t = std::string;
 
 /** Opaque class that wraps the PC/SC resource manager context. */
 class Context;
+
+/** PC/SC API function table, see pcsc-cpp/pcsc-backend.hpp. */
+struct PcscBackend;
 using ContextPtr = std::shared_ptr<Context>;
 
 /** Returns the value of the response status bytes SW1 and SW2 as a single status word SW. */
@@ -73,12 +89,14 @@ struct ResponseApdu
     byte_type sw1 {};
     byte_type sw2 {};
 
-    byte_vector data;
+    apdu_byte_vector data;
 
-    static const size_t MAX_DATA_SIZE = 256;
-    static const size_t MAX_SIZE = MAX_DATA_SIZE + 2; // + sw1 and sw2
+    static constexpr size_t MAX_DATA_SIZE = 256;
+    static constexpr size_t MAX_SIZE = MAX_DATA_SIZE + 2; // + sw1 and sw2
+    static constexpr size_t MAX_EXTENDED_DATA_SIZE = 65536;
+    static constexpr size_t MAX_EXTENDED_SIZE = MAX_EXTENDED_DATA_SIZE + 2;
 
-    ResponseApdu(byte_type s1, byte_type s2, byte_vector d = {}) :
+    ResponseApdu(byte_type s1, byte_type s2, apdu_byte_vector d = {}) :
         sw1(s1), sw2(s2), data(std::move(d))
     {
     }
@@ -93,13 +111,14 @@ struct ResponseApdu
 
         // SW1 and SW2 are in the end
         return ResponseApdu {data[data.size() - 2], data[data.size() - 1],
-                             byte_vector {data.cbegin(), data.cend() - 2}};
+                             apdu_byte_vector {data.cbegin(), data.cend() - 2}};
     }
 
     byte_vector toBytes() const
     {
-        // makes a copy, valid both if data is empty or full
-        auto bytes = data;
+        auto bytes = byte_vector {};
+        bytes.reserve(data.size() + 2);
+        bytes.insert(bytes.end(), data.cbegin(), data.cend());
 
         bytes.push_back(sw1);
         bytes.push_back(sw2);
@@ -114,6 +133,28 @@ struct ResponseApdu
     // TODO: friend function toString() in utilities.hpp
 };
 
+/**
+ * Non-owning view of a response APDU that was received into a caller-provided buffer, valid as
+ * long as the buffer is not modified.
+ */
+struct ResponseApduView
+{
+    byte_type sw1 {};
+    byte_type sw2 {};
+
+    const byte_type* data = nullptr;
+    size_t dataSize = 0;
+
+    uint16_t toSW() const { return pcsc_cpp::toSW(sw1, sw2); }
+
+    bool isOK() const { return sw1 == ResponseApdu::OK && sw2 == 0x00; }
+
+    ResponseApdu toResponseApdu() const
+    {
+        return {sw1, sw2, apdu_byte_vector(data, data + dataSize)};
+    }
+};
+
 /** Struct that wraps command APDUs. */
 struct CommandApdu
 {
@@ -121,26 +162,33 @@ struct CommandApdu
     byte_type ins;
     byte_type p1;
     byte_type p2;
-    unsigned short le;
+    /**
+     * Le, the expected response data length, absent for commands without response data. Le 1 to
+     * 65535 requests that many bytes and Le 0 requests the maximum: 256 bytes in short and 65536
+     * bytes in extended APDUs. Le above ResponseApdu::MAX_DATA_SIZE uses extended length, Le 256
+     * and 0 are both encoded as 0x00 in short APDUs.
+     */
+    std::optional<unsigned short> le;
     // Lc is data.size()
-    byte_vector data;
+    apdu_byte_vector data;
 
-    static const size_t MAX_DATA_SIZE = 255;
-    static const unsigned short LE_UNUSED = std::numeric_limits<unsigned short>::max();
+    static constexpr size_t MAX_DATA_SIZE = 255;
+    static constexpr size_t MAX_EXTENDED_DATA_SIZE = 65535;
+    static constexpr size_t MAX_EXTENDED_LE = std::numeric_limits<unsigned short>::max();
 
-    CommandApdu(byte_type c, byte_type i, byte_type pp1, byte_type pp2, byte_vector d = {},
-                unsigned short l = LE_UNUSED) :
+    CommandApdu(byte_type c, byte_type i, byte_type pp1, byte_type pp2, apdu_byte_vector d = {},
+                std::optional<unsigned short> l = {}) :
         cla(c),
         ins(i), p1(pp1), p2(pp2), le(l), data(std::move(d))
     {
     }
 
-    CommandApdu(const CommandApdu& other, byte_vector d) :
+    CommandApdu(const CommandApdu& other, apdu_byte_vector d) :
         cla(other.cla), ins(other.ins), p1(other.p1), p2(other.p2), le(other.le), data(std::move(d))
     {
     }
 
-    bool isLeSet() const { return le != LE_UNUSED; }
+    bool isLeSet() const { return le.has_value(); }
 
     static CommandApdu fromBytes(const byte_vector& bytes, bool useLe = false)
     {
@@ -155,7 +203,7 @@ struct CommandApdu
         if (bytes.size() == 5) {
             if (useLe) {
                 return CommandApdu {bytes[0], bytes[1],      bytes[2],
-                                    bytes[3], byte_vector(), bytes[4]};
+                                    bytes[3], apdu_byte_vector(), bytes[4]};
             }
             throw std::invalid_argument("Command APDU size 5 is invalid without LE");
         }
@@ -164,6 +212,11 @@ struct CommandApdu
             throw std::invalid_argument("Command APDU size 6 uses LE");
         }
 
+        // Extended length APDUs have a zero byte at offset 4 followed by 2-byte Lc or Le.
+        if (bytes.size() >= 7 && bytes[4] == 0x00) {
+            return fromExtendedBytes(bytes, useLe);
+        }
+
         // 0 - cla, 1 - ins, 2 - p1, 3 - p2, 4 - data size
         // FIXME: can command chaining use byte 5 for data size too?
         auto dataStart = bytes.cbegin() + 5;
@@ -173,20 +226,61 @@ struct CommandApdu
                                 bytes[1],
                                 bytes[2],
                                 bytes[3],
-                                byte_vector(dataStart, bytes.cend() - 1),
+                                apdu_byte_vector(dataStart, bytes.cend() - 1),
                                 *(bytes.cend() - 1)};
         }
         return CommandApdu {bytes[0], bytes[1], bytes[2], bytes[3],
-                            byte_vector(dataStart, bytes.cend())};
+                            apdu_byte_vector(dataStart, bytes.cend())};
+    }
+
+    /** Extended length encoding is needed when Lc > 255 or Le > 256. */
+    bool isExtended() const
+    {
+        return data.size() > MAX_DATA_SIZE || (isLeSet() && *le > ResponseApdu::MAX_DATA_SIZE);
+    }
+
+    /** Size of the buffer that can hold the response data requested with Le plus SW1 and SW2. */
+    size_t responseBufferSize() const
+    {
+        if (!isExtended() || !isLeSet()) {
+            return ResponseApdu::MAX_SIZE;
+        }
+        return *le == 0 ? ResponseApdu::MAX_EXTENDED_SIZE
+                        : std::max(size_t(*le) + 2, ResponseApdu::MAX_SIZE);
     }
 
     byte_vector toBytes() const
     {
-        if (data.size() > MAX_DATA_SIZE) {
-            throw std::invalid_argument("Command chaining not supported");
+        auto bytes = byte_vector {};
+        toBytes(bytes);
+        return bytes;
+    }
+
+    /** Serialize into bytes, reusing its capacity when the same buffer serializes many APDUs. */
+    void toBytes(byte_vector& bytes) const
+    {
+        if (data.size() > MAX_EXTENDED_DATA_SIZE) {
+            throw std::invalid_argument("Command data larger than maximum extended length");
         }
 
-        auto bytes = byte_vector {cla, ins, p1, p2};
+        // Header, Lc and Le are 1 byte each in short and up to 3 and 2 bytes in extended APDUs.
+        bytes.clear();
+        bytes.reserve(isExtended() ? 4 + 3 + data.size() + 2 : 4 + 1 + data.size() + 1);
+        bytes.assign({cla, ins, p1, p2});
+
+        if (isExtended()) {
+            bytes.push_back(0x00);
+            if (!data.empty()) {
+                bytes.push_back(static_cast<byte_type>(data.size() >> 8));
+                bytes.push_back(static_cast<byte_type>(data.size()));
+                bytes.insert(bytes.end(), data.cbegin(), data.cend());
+            }
+            if (isLeSet()) {
+                bytes.push_back(static_cast<byte_type>(*le >> 8));
+                bytes.push_back(static_cast<byte_type>(*le));
+            }
+            return;
+        }
 
         if (!data.empty()) {
             bytes.push_back(static_cast<byte_type>(data.size()));
@@ -195,15 +289,121 @@ struct CommandApdu
 
         if (isLeSet()) {
             // TODO: EstEID spec: the maximum value of Le is 0xFE
-            if (le > ResponseApdu::MAX_DATA_SIZE)
-                throw std::invalid_argument("LE larger than response size");
-            bytes.push_back(static_cast<byte_type>(le));
+            bytes.push_back(static_cast<byte_type>(*le));
         }
+    }
 
-        return bytes;
+private:
+    static CommandApdu fromExtendedBytes(const byte_vector& bytes, bool useLe)
+    {
+        // 0 - cla, 1 - ins, 2 - p1, 3 - p2, 4 - 0x00, 5 and 6 - Lc or Le
+        if (bytes.size() == 7) {
+            if (!useLe) {
+                throw std::invalid_argument("Extended command APDU size 7 is invalid without LE");
+            }
+            return CommandApdu {bytes[0],
+                                bytes[1],
+                                bytes[2],
+                                bytes[3],
+                                apdu_byte_vector(),
+                                static_cast<unsigned short>((bytes[5] << 8) | bytes[6])};
+        }
+
+        const auto leSize = useLe ? size_t(2) : size_t(0);
+        const auto dataSize = size_t((bytes[5] << 8) | bytes[6]);
+        if (dataSize == 0 || bytes.size() != 7 + dataSize + leSize) {
+            throw std::invalid_argument("Extended command APDU Lc does not match APDU size");
+        }
+
+        auto dataStart = bytes.cbegin() + 7;
+        auto dataEnd = dataStart + std::ptrdiff_t(dataSize);
+
+        if (useLe) {
+            return CommandApdu {bytes[0],
+                                bytes[1],
+                                bytes[2],
+                                bytes[3],
+                                apdu_byte_vector(dataStart, dataEnd),
+                                static_cast<unsigned short>((*dataEnd << 8) | *(dataEnd + 1))};
+        }
+        return CommandApdu {bytes[0], bytes[1], bytes[2], bytes[3],
+                            apdu_byte_vector(dataStart, dataEnd)};
     }
 };
 
+/**
+ * Responses of SmartCard::transmitBatch(). The response data of all commands is stored
+ * contiguously in arena, records hold the data offset, length and status bytes of each response.
+ */
+struct BatchResponse
+{
+    struct Record
+    {
+        size_t offset;
+        size_t length;
+        byte_type sw1;
+        byte_type sw2;
+    };
+
+    byte_vector arena;
+    std::vector<Record> records;
+
+    /** Number of transmitted commands, less than the number of commands if the batch stopped. */
+    size_t size() const { return records.size(); }
+
+    ResponseApduView operator[](size_t i) const
+    {
+        const auto& record = records.at(i);
+        return {record.sw1, record.sw2, arena.data() + record.offset, record.length};
+    }
+};
+
+/**
+ * ResponseCache memoizes the responses to commands that isIdempotent marks as safe to cache, so
+ * that repeated reads of read-only files cost no card I/O. Nothing is cached by default, mark only
+ * commands that target read-only EFs, for example SELECT and READ BINARY of certificate files.
+ * Enable it for a card with SmartCard::setResponseCache(), one cache can be shared by many cards
+ * and card sessions. Entries are keyed by the card identity, that is the ATR and a serial number
+ * supplied by the caller, the currently selected file and the command bytes. Only successful
+ * responses are cached.
+ *
+ * A cache hit does not reach the card, so card reset, card swap or lost authentication state are
+ * not noticed until the next command that is sent to the card. The entries of a card are dropped
+ * - when a command that is neither idempotent nor SELECT succeeds, as it may have written data,
+ * - when a command is sent with SmartCard::transmit(bytes, buffer) or transmitBatch(),
+ * - when a SELECT that was served from cache fails once it is sent to the card,
+ * - when transmit fails with ScardCardRemovedError or ScardCardCommunicationFailedError, which is
+ *   also thrown after card reset.
+ * Call invalidate() on reader status changes, for example on ReaderMonitor::Event::CARD_REMOVED.
+ */
+class ResponseCache
+{
+public:
+    using IdempotentPredicate = std::function<bool(const CommandApdu&)>;
+
+    explicit ResponseCache(IdempotentPredicate isIdempotent = {});
+    ~ResponseCache();
+    PCSC_CPP_DISABLE_COPY_MOVE(ResponseCache);
+
+    bool isIdempotent(const CommandApdu& command) const;
+
+    std::optional<ResponseApdu> find(const byte_vector& atr, const std::string& cardSerial,
+                                     const byte_vector& key) const;
+    void store(const byte_vector& atr, const std::string& cardSerial, const byte_vector& key,
+               const ResponseApdu& response);
+
+    void invalidate(const byte_vector& atr, const std::string& cardSerial);
+    void invalidate();
+    size_t size() const;
+
+private:
+    class Impl;
+    std::unique_ptr<Impl> impl;
+};
+
+class Error;
+struct ApduSession;
+
 /** Opaque class that wraps the PC/SC smart card resources like card handle and I/O protocol. */
 class CardImpl;
 using CardImplPtr = std::unique_ptr<CardImpl>;
@@ -216,39 +416,195 @@ class SmartCard
 {
 public:
     enum class Protocol { UNDEFINED, T0, T1 }; // AUTO = T0 | T1
+    enum class ReplayPace { AS_FAST_AS_POSSIBLE, RECORDED };
 
     using ptr = std::unique_ptr<SmartCard>;
 
+    /**
+     * Guards can be nested, only the outermost guard begins and ends the PC/SC transaction, so
+     * helpers can open their own guard inside the caller's transaction.
+     */
     class TransactionGuard
     {
     public:
-        TransactionGuard(const CardImpl& CardImpl, bool& inProgress);
+        TransactionGuard(const CardImpl& CardImpl, std::atomic<unsigned>& depth);
         ~TransactionGuard();
         PCSC_CPP_DISABLE_COPY_MOVE(TransactionGuard);
 
     private:
         const CardImpl& card;
-        bool& inProgress;
+        std::atomic<unsigned>& depth;
     };
 
     SmartCard(const ContextPtr& context, const string_t& readerName, byte_vector atr);
+    /**
+     * Replay the recorded session instead of using a reader. The commands must be sent in the
+     * recorded order, the recorded responses and errors are returned either immediately or after
+     * the recorded duration of each exchange.
+     *
+     * @throw Error from transmit if a command differs from the recorded one.
+     */
+    explicit SmartCard(ApduSession session, ReplayPace pace = ReplayPace::AS_FAST_AS_POSSIBLE);
     SmartCard(); // Null object constructor.
     ~SmartCard();
     PCSC_CPP_DISABLE_COPY_MOVE(SmartCard);
 
     TransactionGuard beginTransaction();
+    /**
+     * Transmit the command APDU to the card. Commands with more than 255 bytes of data are sent
+     * with command chaining unless extended length is enabled with setExtendedLengthSupported().
+     */
     ResponseApdu transmit(const CommandApdu& command) const;
+    /**
+     * Transmit serialized command bytes and receive the response into responseBuffer without
+     * allocating. The buffer size is the receive capacity, it must fit the whole response
+     * including GET RESPONSE continuations and SW1 SW2, the buffer is not resized.
+     */
+    ResponseApduView transmit(const byte_vector& commandBytes, byte_vector& responseBuffer) const;
+    /**
+     * Transmit the commands in one transaction, the current transaction is used if one is in
+     * progress. Stops after the first response for which continueIf returns false, by default
+     * after the first response that is not 90 00.
+     */
+    BatchResponse
+    transmitBatch(const std::vector<CommandApdu>& commands,
+                  const std::function<bool(const ResponseApduView&)>& continueIf = {});
     ResponseApdu transmitCTL(const CommandApdu& command, uint16_t lang, uint8_t minlen) const;
     bool readerHasPinPad() const;
+    /**
+     * Keep the PC/SC transaction open after the outermost TransactionGuard ends, so that bursts of
+     * operations skip SCardBeginTransaction() and SCardEndTransaction(). The held transaction is
+     * released after idleTime without a guard or once it has been open for maxHoldTime, which
+     * bounds the time that other processes wait for the card. Zero idleTime disables holding.
+     *
+     * The held transaction is ended from a background thread, so holding requires a PC/SC
+     * backend that allows the card handle to be used from another thread than the one that owns
+     * the context. Windows winscard, pcsc-lite, which serializes the calls of a context, and the
+     * card emulator allow it. Do not enable holding with backends that confine handles to one
+     * thread.
+     */
+    void setTransactionHold(std::chrono::milliseconds idleTime,
+                            std::chrono::milliseconds maxHoldTime);
+    /**
+     * Check with SCardStatus() that the card handle is still usable, returns false if the card
+     * has been removed or reset.
+     */
+    bool isConnected() const;
+
+    /**
+     * Record every SCardTransmit() and SCardControl() call with its timing until
+     * stopSessionRecording(), including GET RESPONSE and command chaining segments.
+     */
+    void startSessionRecording();
+    ApduSession stopSessionRecording();
 
     Protocol protocol() const { return _protocol; }
     const byte_vector& atr() const { return _atr; }
 
+    bool extendedLengthSupported() const { return _extendedLengthSupported; }
+    void setExtendedLengthSupported(bool supported) { _extendedLengthSupported = supported; }
+
+    /**
+     * Serve idempotent commands sent with transmit(const CommandApdu&) from cache for the card
+     * identified by its ATR and cardSerial, pass nullptr to disable caching. SELECT commands that
+     * are served from cache are sent to the card before the next command that is not.
+     */
+    void setResponseCache(std::shared_ptr<ResponseCache> cache, std::string cardSerial);
+
 private:
+    ResponseApdu transmitCommand(const CommandApdu& command) const;
+    ResponseApdu transmitCached(const CommandApdu& command) const;
+    void transmitPendingSelects() const;
+
     CardImplPtr card;
     byte_vector _atr;
     Protocol _protocol = Protocol::UNDEFINED;
-    bool transactionInProgress = false;
+    bool _extendedLengthSupported = false;
+    // Atomic as TransmitExecutor threads check it while the owning thread opens guards.
+    std::atomic<unsigned> transactionDepth {0};
+
+    std::shared_ptr<ResponseCache> responseCache;
+    std::string responseCacheCardSerial;
+    // SELECT commands since the last absolute selection, identifies the current file.
+    mutable byte_vector selectionContext;
+    mutable std::vector<CommandApdu> pendingSelects;
+};
+
+/**
+ * The SCardTransmit() and SCardControl() calls of one card with their results and timing, see
+ * SmartCard::startSessionRecording(). Sessions can be replayed by a SmartCard that is created
+ * from the session, so card flows can be tested and measured repeatably without a reader.
+ *
+ * The binary format is the magic "PCSCSESS", a format version byte and the session fields,
+ * followed by the exchanges until the end of data. Integers are unsigned LEB128 varints, byte
+ * strings and the reader name are prefixed with their length, the reader name is stored as code
+ * units. An exchange is the kind byte, the control code for SCardControl(), the result, the start
+ * time as the delta from the previous exchange, the duration, the command and the response.
+ */
+struct ApduSession
+{
+    static constexpr uint8_t VERSION = 1;
+
+    struct Exchange
+    {
+        enum class Kind : uint8_t { TRANSMIT = 1, CONTROL = 2 };
+
+        Kind kind = Kind::TRANSMIT;
+        uint32_t controlCode = 0;
+        // PC/SC result code, replayed errors are thrown like the recorded ones.
+        uint32_t result = 0;
+        // Since the start of recording.
+        std::chrono::microseconds start {0};
+        std::chrono::microseconds duration {0};
+        byte_vector command;
+        // Empty if the call failed.
+        byte_vector response;
+    };
+
+    string_t reader;
+    byte_vector atr;
+    SmartCard::Protocol protocol = SmartCard::Protocol::UNDEFINED;
+    // Reader feature control codes indexed by CM_IOCTL_GET_FEATURE_REQUEST tag.
+    std::vector<uint32_t> readerFeatures;
+    std::vector<Exchange> exchanges;
+
+    byte_vector serialize() const;
+    /** @throw Error if the data is not a valid session. */
+    static ApduSession deserialize(const byte_vector& data);
+
+    /** @throw SystemError if the file cannot be written. */
+    void save(const std::string& filePath) const;
+    /** @throw SystemError if the file cannot be read, Error if it is not a valid session. */
+    static ApduSession load(const std::string& filePath);
+};
+
+/**
+ * TransmitExecutor transmits APDUs asynchronously on a small thread pool, so that many cards can
+ * be driven without one blocked thread per reader. Every card has a serial queue, its commands
+ * are transmitted in submission order while different cards run in parallel. When a card queue
+ * holds maxQueueDepth commands, transmitAsync() blocks until a command completes.
+ *
+ * The usual rule applies: commands are transmitted inside a transaction, keep the card and its
+ * TransactionGuard alive until all futures are ready. Errors are reported through the futures.
+ * Pending commands are completed before the executor is destroyed.
+ *
+ * The pool threads use the PC/SC context of the cards. pcsc-lite does not allow a context to be
+ * used from several threads at the same time, so every card that is submitted to an executor with
+ * more than one thread must be connected in its own context, see establishContext(). Do not use
+ * a card from other threads while it has pending commands.
+ */
+class TransmitExecutor
+{
+public:
+    explicit TransmitExecutor(size_t threadCount = 2, size_t maxQueueDepth = 16);
+    ~TransmitExecutor();
+    PCSC_CPP_DISABLE_COPY_MOVE(TransmitExecutor);
+
+    std::future<ResponseApdu> transmitAsync(const SmartCard& card, CommandApdu command);
+
+private:
+    class Impl;
+    std::unique_ptr<Impl> impl;
 };
 
 /** Reader provides card reader information, status and gives access to the smart card in it. */
@@ -294,6 +650,384 @@ private:
  */
 std::vector<Reader> listReaders();
 
+/**
+ * Establish a PC/SC resource manager context that can be reused across listReaders(ctx) calls to
+ * avoid a context round trip to the PC/SC service on every call.
+ *
+ * @throw ScardError, SystemError
+ */
+ContextPtr establishContext();
+
+/**
+ * Establish a context that routes all PC/SC calls through the backend, see
+ * pcsc-cpp/pcsc-backend.hpp.
+ *
+ * @throw ScardError, SystemError
+ */
+ContextPtr establishContext(const PcscBackend& backend);
+
+/**
+ * Access system smart card readers using the given long-lived context. The context is checked
+ * with SCardIsValidContext() and re-established when it is no longer valid or when the PC/SC
+ * service has been restarted.
+ *
+ * @throw ScardError, SystemError
+ */
+std::vector<Reader> listReaders(const ContextPtr& ctx);
+
+/**
+ * ReaderSnapshot keeps the reader name buffer and reader states between refreshes and reports
+ * only the readers that were added, removed or changed. Unchanged readers are detected from the
+ * reader state and the pcsc-lite event counter, so they cost no Reader copies.
+ *
+ * @throw ScardError, SystemError
+ */
+class ReaderSnapshot
+{
+public:
+    struct Diff
+    {
+        std::vector<Reader> added;
+        std::vector<Reader> removed;
+        std::vector<Reader> changed;
+
+        bool empty() const { return added.empty() && removed.empty() && changed.empty(); }
+    };
+
+    explicit ReaderSnapshot(ContextPtr ctx);
+    ~ReaderSnapshot();
+    PCSC_CPP_DISABLE_COPY_MOVE(ReaderSnapshot);
+
+    /** Refresh reader states, the first refresh reports all readers as added. */
+    Diff refresh();
+
+    /** Readers as of the last refresh. */
+    std::vector<Reader> readers() const;
+
+private:
+    class Impl;
+    std::unique_ptr<Impl> impl;
+};
+
+/**
+ * ReaderMonitor reports reader attach and detach and card insert and remove events from a
+ * background thread that blocks in SCardGetStatusChange() until the PC/SC service signals a
+ * change, so there is no polling. Readers and cards that are present when monitoring starts are
+ * reported as attached and inserted.
+ *
+ * Callbacks run in the monitor thread, they must not destroy the monitor. The error callback is
+ * called when monitoring stops because of an error, for example when the PC/SC service stops.
+ *
+ * @throw ScardError, SystemError
+ */
+class ReaderMonitor
+{
+public:
+    enum class Event { READER_ATTACHED, READER_DETACHED, CARD_INSERTED, CARD_REMOVED };
+
+    using EventCallback = std::function<void(Event event, const Reader& reader)>;
+    using ErrorCallback = std::function<void(const std::exception& error)>;
+
+    explicit ReaderMonitor(EventCallback onEvent, ErrorCallback onError = {});
+    ~ReaderMonitor();
+    PCSC_CPP_DISABLE_COPY_MOVE(ReaderMonitor);
+
+private:
+    class Impl;
+    std::unique_ptr<Impl> impl;
+};
+
+/**
+ * ReaderWorkerPool runs jobs on the cards in a set of readers with one worker thread per reader.
+ * Each worker has its own PC/SC context as pcsc-lite requires for thread safety. Workers whose
+ * reader has a connected card take the next job from the shared queue, so throughput scales with
+ * the number of readers that have a card. Jobs receive the card inside a transaction.
+ *
+ * A job that cannot begin a transaction is returned to the front of the queue for another reader.
+ * A worker stops when its reader goes away or the PC/SC service stops. Once all workers have
+ * stopped, pending and new jobs fail with the error of the last worker. Jobs that are still
+ * pending when the pool is destroyed are abandoned, their futures report
+ * std::future_errc::broken_promise. Job functions must be copyable.
+ *
+ * @throw ScardError, SystemError
+ */
+class ReaderWorkerPool
+{
+public:
+    using Job = std::function<void(SmartCard& card)>;
+
+    explicit ReaderWorkerPool(const std::vector<string_t>& readerNames);
+    ~ReaderWorkerPool();
+    PCSC_CPP_DISABLE_COPY_MOVE(ReaderWorkerPool);
+
+    template <typename Func>
+    std::future<std::invoke_result_t<Func, SmartCard&>> submit(Func func)
+    {
+        using Result = std::invoke_result_t<Func, SmartCard&>;
+        auto promise = std::make_shared<std::promise<Result>>();
+        auto future = promise->get_future();
+        enqueue(
+            [promise, func = std::move(func)](SmartCard& card) {
+                try {
+                    if constexpr (std::is_void_v<Result>) {
+                        func(card);
+                        promise->set_value();
+                    } else {
+                        promise->set_value(func(card));
+                    }
+                } catch (...) {
+                    promise->set_exception(std::current_exception());
+                    // Let the worker see card errors so that it can reconnect.
+                    throw;
+                }
+            },
+            [promise](std::exception_ptr error) { promise->set_exception(error); });
+        return future;
+    }
+
+    size_t pendingJobCount() const;
+
+private:
+    using JobFailure = std::function<void(std::exception_ptr error)>;
+
+    void enqueue(Job job, JobFailure fail);
+
+    class Impl;
+    std::unique_ptr<Impl> impl;
+};
+
+/**
+ * CardConnectionPool keeps cards connected after use and hands them out as leases, so that
+ * repeated connections to the same card cost no SCardConnect() and SCardDisconnect(). Idle cards
+ * are checked with SmartCard::isConnected() before reuse and disconnected when the card has been
+ * removed or reset. At most maxIdleCards idle cards stay connected, the least recently used card is
+ * disconnected first.
+ *
+ * Leases return the card to the pool when destroyed, end transactions before that. Call
+ * Lease::discard() to disconnect a card that is in an unknown state, for example after an error.
+ */
+class CardConnectionPool
+{
+    class Impl;
+
+public:
+    class Lease
+    {
+    public:
+        Lease(std::weak_ptr<Impl> pool, string_t readerName, SmartCard::ptr card);
+        ~Lease();
+        Lease(Lease&& other) noexcept;
+        Lease& operator=(Lease&& other) noexcept;
+        Lease(const Lease&) = delete;
+        Lease& operator=(const Lease&) = delete;
+
+        SmartCard& operator*() const { return *card; }
+        SmartCard* operator->() const { return card.get(); }
+
+        void discard() { card.reset(); }
+
+    private:
+        void release() noexcept;
+
+        std::weak_ptr<Impl> pool;
+        string_t readerName;
+        SmartCard::ptr card;
+    };
+
+    explicit CardConnectionPool(size_t maxIdleCards = 8);
+    ~CardConnectionPool();
+    PCSC_CPP_DISABLE_COPY_MOVE(CardConnectionPool);
+
+    /** Lease an idle card of the reader or connect to the card in the reader. */
+    Lease acquire(const Reader& reader);
+
+    size_t idleCount() const;
+    /** Disconnect all idle cards. */
+    void clear();
+
+private:
+    std::shared_ptr<Impl> impl;
+};
+
+/** Parameters learned about a card in a reader, see CardProfileCache. */
+struct CardProfile
+{
+    bool extendedLengthSupported = false;
+    // Block length that worked with the adaptive readBinary(), 0 if not known.
+    size_t readBinaryBlockLength = 0;
+};
+
+/**
+ * CardProfileCache keeps card profiles in a memory-mapped file, keyed by card ATR and reader
+ * name, so that later sessions start with the best settings on the first APDU. The file is shared
+ * safely between threads and processes with file locks. A file with an older format version is
+ * reinitialized, a file from a newer library version is left untouched and the cache stays empty.
+ * The cache has a fixed number of entries, the oldest entry is replaced when it is full. Entries
+ * that cannot be applied, for example with an invalid block length, are ignored and cleared.
+ *
+ * @throw SystemError if the file cannot be opened or mapped or on Windows, where the cache is not
+ * supported yet.
+ */
+class CardProfileCache
+{
+public:
+    static constexpr uint32_t VERSION = 1;
+
+    explicit CardProfileCache(const std::string& filePath);
+    ~CardProfileCache();
+    PCSC_CPP_DISABLE_COPY_MOVE(CardProfileCache);
+
+    std::optional<CardProfile> find(const Reader& reader) const;
+    void store(const Reader& reader, const CardProfile& profile);
+
+    /** Apply the stored profile of the card in reader to card, returns false if there is none. */
+    bool apply(const Reader& reader, SmartCard& card) const;
+    /** Store the parameters that have been learned about the card in reader. */
+    void update(const Reader& reader, const SmartCard& card);
+
+private:
+    class Impl;
+    std::unique_ptr<Impl> impl;
+};
+
+/**
+ * Decoded answer-to-reset, see ISO/IEC 7816-3 section 8 for the interface bytes and ISO/IEC
+ * 7816-4 section 8.1.1 for the historical bytes. Fields have the standard default values when
+ * the corresponding interface byte is absent.
+ */
+struct AtrInfo
+{
+    enum class Convention { DIRECT, INVERSE };
+
+    Convention convention = Convention::DIRECT;
+
+    // TA1, clock rate conversion factor, maximum clock frequency and baud rate adjustment factor,
+    // 0 when the ATR uses a reserved value.
+    uint16_t fi = 372;
+    uint16_t fMaxKHz = 5000;
+    uint8_t di = 1;
+    // TC1, extra guard time in etu.
+    uint8_t extraGuardTime = 0;
+
+    // Protocols offered in the TD bytes, T=0 if none.
+    bool t0Supported = false;
+    bool t1Supported = false;
+    // TA2, the card is in specific mode with the given protocol.
+    bool specificMode = false;
+    uint8_t specificModeProtocol = 0;
+
+    // TC2, T=0 waiting time integer.
+    uint8_t waitingTimeInteger = 10;
+    // First TA, TB and TC for T=1, information field size, block and character waiting time
+    // integers and error detection code.
+    uint8_t ifsc = 32;
+    uint8_t bwi = 4;
+    uint8_t cwi = 13;
+    bool crcErrorDetection = false;
+
+    byte_vector historicalBytes;
+    // Card capabilities from the compact-TLV historical bytes, software function table byte 3.
+    bool hasCardCapabilities = false;
+    bool commandChainingSupported = false;
+    bool extendedLengthSupported = false;
+};
+
+/**
+ * Parse the ATR, for example SmartCard::atr() or Reader::cardAtr. The card capabilities can be
+ * used to set SmartCard::setExtendedLengthSupported(), the reader must support extended APDUs too.
+ *
+ * @throw Error if the ATR is malformed or its check byte is wrong.
+ */
+AtrInfo parseAtr(const byte_vector& atr);
+
+/**
+ * Metrics of the PC/SC API calls of one function in one reader, see scardCallMetrics(). Latencies
+ * are recorded in a log-linear histogram with four linear buckets per power of two microseconds.
+ */
+struct SCardCallMetrics
+{
+    static constexpr size_t HISTOGRAM_BUCKET_COUNT = 4 + 4 * 30;
+
+    std::string function;
+    // Empty if the call is not related to a reader.
+    string_t reader;
+    uint64_t callCount = 0;
+    uint64_t totalLatencyMicros = 0;
+    // Error counts by PC/SC result code.
+    std::map<uint32_t, uint64_t> errorCounts;
+    std::vector<uint64_t> latencyHistogram;
+
+    static size_t bucketIndex(uint64_t latencyMicros);
+    static uint64_t bucketLowerBoundMicros(size_t bucket);
+    /** Lower bound of the histogram bucket that contains the given percentile, 0..100. */
+    uint64_t percentileMicros(double percentile) const;
+};
+
+/**
+ * Snapshot of the PC/SC API call metrics that have been recorded in this process. Returns an
+ * empty vector unless the library was built with the PCSC_CPP_METRICS option.
+ */
+std::vector<SCardCallMetrics> scardCallMetrics();
+void resetSCardCallMetrics();
+
+/** Command and response bytes of one exchange with a card, see ApduTraceSink. */
+struct ApduExchange
+{
+    std::chrono::system_clock::time_point timestamp;
+    std::chrono::microseconds duration;
+    const string_t* reader;
+    const byte_type* command;
+    size_t commandSize;
+    // Empty if the exchange failed.
+    const byte_type* response;
+    size_t responseSize;
+};
+
+/**
+ * Receives every APDU exchange, including GET RESPONSE and chaining segments, in the thread that
+ * transmits. The exchange data is only valid during the call. Exceptions are ignored.
+ */
+class ApduTraceSink
+{
+public:
+    virtual ~ApduTraceSink() = default;
+    virtual void onExchange(const ApduExchange& exchange) = 0;
+};
+
+/** Install the trace sink, pass nullptr to remove it. Tracing costs nothing without a sink. */
+void setApduTraceSink(std::shared_ptr<ApduTraceSink> sink);
+
+/**
+ * Exchange in the flight recorder that always keeps the last FLIGHT_RECORDER_SIZE exchanges.
+ * At most FLIGHT_RECORDER_MAX_BYTES bytes of the reader name, command and response are kept,
+ * commandSize and responseSize are the full sizes.
+ */
+struct ApduTraceRecord
+{
+    static constexpr size_t FLIGHT_RECORDER_SIZE = 64;
+    static constexpr size_t FLIGHT_RECORDER_MAX_BYTES = 64;
+
+    std::chrono::system_clock::time_point timestamp;
+    std::chrono::microseconds duration;
+    string_t reader;
+    byte_vector command;
+    size_t commandSize;
+    byte_vector response;
+    size_t responseSize;
+};
+
+using FlightRecorderDumpHandler =
+    std::function<void(const Error& error, const std::vector<ApduTraceRecord>& lastExchanges)>;
+
+/**
+ * Install the handler that receives the flight recorder contents, oldest first, when a transmit
+ * fails with Error. Pass an empty handler to remove it.
+ */
+void setFlightRecorderDumpHandler(FlightRecorderDumpHandler handler);
+
+/** The exchanges in the flight recorder, oldest first. */
+std::vector<ApduTraceRecord> flightRecorderSnapshot();
+
 // Utility functions.
 
 extern const byte_vector APDU_RESPONSE_OK;
@@ -310,9 +1044,27 @@ void transmitApduWithExpectedResponse(const SmartCard& card, const byte_vector&
 /** Read data length from currently selected file header, file must be ASN.1-encoded. */
 size_t readDataLengthFromAsn1(const SmartCard& card);
 
-/** Read lenght bytes from currently selected binary file in blockLength-sized chunks. */
+/**
+ * Read lenght bytes from currently selected binary file in blockLength-sized chunks.
+ * Block lengths above 256 use extended length APDUs, the card must support them.
+ */
 byte_vector readBinary(const SmartCard& card, const size_t length, const size_t blockLength);
 
+/**
+ * Read length bytes from currently selected binary file with an adaptive block length. Starts
+ * with the largest block, 256 bytes or the extended length maximum if the card supports it, and
+ * shrinks it on 0x67 and 0x6C. The block length that worked is reused for cards with the same ATR.
+ */
+byte_vector readBinary(const SmartCard& card, const size_t length);
+
+/** Block length that the adaptive readBinary() uses for cards with atr, 0 if not known yet. */
+size_t readBinaryBlockLength(const byte_vector& atr);
+/**
+ * Set the block length that the adaptive readBinary() uses for cards with atr, 0 forgets it so
+ * that readBinary() starts with the largest block again.
+ */
+void setReadBinaryBlockLength(const byte_vector& atr, const size_t blockLength);
+
 // Errors.
 
 /** Base class for all pcsc-cpp errors. */
@@ -0,0 +1,317 @@
+/*
+ * Copyright (c) 2020-2023 Estonian Information System Authority
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <cstring>
+#include <functional>
+#include <initializer_list>
+#include <iterator>
+#include <memory>
+#include <stdexcept>
+#include <type_traits>
+#include <vector>
+
+namespace pcsc_cpp
+{
+
+/**
+ * Byte vector that keeps up to InlineCapacity bytes inside the object and moves the bytes to the
+ * heap only when they do not fit. Provides the subset of the std::vector interface that is used
+ * with APDU data and converts implicitly to and from std::vector<unsigned char>.
+ */
+template <size_t InlineCapacity>
+class small_byte_vector
+{
+public:
+    using value_type = unsigned char;
+    using size_type = size_t;
+    using difference_type = std::ptrdiff_t;
+    using reference = value_type&;
+    using const_reference = const value_type&;
+    using pointer = value_type*;
+    using const_pointer = const value_type*;
+    using iterator = pointer;
+    using const_iterator = const_pointer;
+
+    small_byte_vector() = default;
+
+    explicit small_byte_vector(size_type count, value_type value = 0) { resize(count, value); }
+
+    template <typename InputIt,
+              typename = std::enable_if_t<std::is_base_of_v<
+                  std::input_iterator_tag,
+                  typename std::iterator_traits<InputIt>::iterator_category>>>
+    small_byte_vector(InputIt first, InputIt last)
+    {
+        insert(end(), first, last);
+    }
+
+    small_byte_vector(std::initializer_list<value_type> values) :
+        small_byte_vector(values.begin(), values.end())
+    {
+    }
+
+    small_byte_vector(const std::vector<value_type>& other) :
+        small_byte_vector(other.cbegin(), other.cend())
+    {
+    }
+
+    small_byte_vector(const small_byte_vector& other) :
+        small_byte_vector(other.cbegin(), other.cend())
+    {
+    }
+
+    small_byte_vector(small_byte_vector&& other) noexcept { moveFrom(other); }
+
+    ~small_byte_vector() = default;
+
+    small_byte_vector& operator=(const small_byte_vector& other)
+    {
+        if (this != &other) {
+            assign(other.cbegin(), other.cend());
+        }
+        return *this;
+    }
+
+    small_byte_vector& operator=(small_byte_vector&& other) noexcept
+    {
+        if (this != &other) {
+            moveFrom(other);
+        }
+        return *this;
+    }
+
+    operator std::vector<value_type>() const { return {cbegin(), cend()}; }
+
+    template <typename InputIt>
+    void assign(InputIt first, InputIt last)
+    {
+        clear();
+        insert(end(), first, last);
+    }
+
+    pointer data() noexcept { return heap ? heap.get() : inlineBuffer; }
+    const_pointer data() const noexcept { return heap ? heap.get() : inlineBuffer; }
+
+    iterator begin() noexcept { return data(); }
+    iterator end() noexcept { return data() + _size; }
+    const_iterator begin() const noexcept { return data(); }
+    const_iterator end() const noexcept { return data() + _size; }
+    const_iterator cbegin() const noexcept { return begin(); }
+    const_iterator cend() const noexcept { return end(); }
+
+    reference operator[](size_type pos) { return data()[pos]; }
+    const_reference operator[](size_type pos) const { return data()[pos]; }
+
+    reference at(size_type pos)
+    {
+        if (pos >= _size) {
+            throw std::out_of_range("small_byte_vector::at()");
+        }
+        return data()[pos];
+    }
+    const_reference at(size_type pos) const
+    {
+        if (pos >= _size) {
+            throw std::out_of_range("small_byte_vector::at()");
+        }
+        return data()[pos];
+    }
+
+    reference front() { return data()[0]; }
+    const_reference front() const { return data()[0]; }
+    reference back() { return data()[_size - 1]; }
+    const_reference back() const { return data()[_size - 1]; }
+
+    bool empty() const noexcept { return _size == 0; }
+    size_type size() const noexcept { return _size; }
+    size_type capacity() const noexcept { return _capacity; }
+    static constexpr size_type inline_capacity() noexcept { return InlineCapacity; }
+
+    void reserve(size_type newCapacity)
+    {
+        if (newCapacity <= _capacity) {
+            return;
+        }
+        auto newHeap = std::make_unique<value_type[]>(newCapacity);
+        std::memcpy(newHeap.get(), data(), _size);
+        heap = std::move(newHeap);
+        _capacity = newCapacity;
+    }
+
+    void resize(size_type count, value_type value = 0)
+    {
+        if (count > _size) {
+            reserveForGrowth(count);
+            std::memset(data() + _size, value, count - _size);
+        }
+        _size = count;
+    }
+
+    void clear() noexcept { _size = 0; }
+
+    void push_back(value_type value)
+    {
+        reserveForGrowth(_size + 1);
+        data()[_size++] = value;
+    }
+
+    void pop_back() { --_size; }
+
+    iterator insert(const_iterator pos, value_type value)
+    {
+        return insert(pos, &value, &value + 1);
+    }
+
+    iterator insert(const_iterator pos, std::initializer_list<value_type> values)
+    {
+        return insert(pos, values.begin(), values.end());
+    }
+
+    template <typename InputIt,
+              typename = std::enable_if_t<std::is_base_of_v<
+                  std::input_iterator_tag,
+                  typename std::iterator_traits<InputIt>::iterator_category>>>
+    iterator insert(const_iterator pos, InputIt first, InputIt last)
+    {
+        const auto offset = size_type(pos - cbegin());
+        using category = typename std::iterator_traits<InputIt>::iterator_category;
+        if constexpr (std::is_base_of_v<std::forward_iterator_tag, category>) {
+            const auto count = size_type(std::distance(first, last));
+            if (count == 0) {
+                return begin() + offset;
+            }
+            // The source may point into this vector, copy it before the storage moves.
+            if (_size + count > _capacity) {
+                small_byte_vector grown;
+                grown.reserve(std::max(_size + count, _capacity * 2));
+                grown.insert(grown.end(), cbegin(), cbegin() + offset);
+                grown.insert(grown.end(), first, last);
+                grown.insert(grown.end(), cbegin() + offset, cend());
+                *this = std::move(grown);
+                return begin() + offset;
+            }
+            if constexpr (std::is_pointer_v<InputIt>) {
+                // Moving the tail would overwrite a source range that points into this vector.
+                const auto isOwnStorage = std::less_equal<const value_type*> {}(data(), first)
+                    && std::less<const value_type*> {}(first, data() + _size);
+                if (isOwnStorage) {
+                    const small_byte_vector source(first, last);
+                    return insert(pos, source.cbegin(), source.cend());
+                }
+            }
+            auto* insertAt = data() + offset;
+            std::memmove(insertAt + count, insertAt, _size - offset);
+            std::copy(first, last, insertAt);
+            _size += count;
+        } else {
+            for (auto i = offset; first != last; ++first, ++i) {
+                insert(cbegin() + i, *first);
+            }
+        }
+        return begin() + offset;
+    }
+
+    iterator erase(const_iterator first, const_iterator last)
+    {
+        const auto offset = size_type(first - cbegin());
+        const auto count = size_type(last - first);
+        std::memmove(data() + offset, data() + offset + count, _size - offset - count);
+        _size -= count;
+        return begin() + offset;
+    }
+
+    void swap(small_byte_vector& other) noexcept
+    {
+        auto tmp = std::move(other);
+        other = std::move(*this);
+        *this = std::move(tmp);
+    }
+
+private:
+    void reserveForGrowth(size_type required)
+    {
+        if (required > _capacity) {
+            reserve(std::max(required, _capacity * 2));
+        }
+    }
+
+    void moveFrom(small_byte_vector& other) noexcept
+    {
+        if (other.heap) {
+            heap = std::move(other.heap);
+            _capacity = other._capacity;
+        } else {
+            heap.reset();
+            _capacity = InlineCapacity;
+            std::memcpy(inlineBuffer, other.inlineBuffer, other._size);
+        }
+        _size = other._size;
+        other._size = 0;
+        other._capacity = InlineCapacity;
+    }
+
+    std::unique_ptr<value_type[]> heap;
+    size_type _size = 0;
+    size_type _capacity = InlineCapacity;
+    value_type inlineBuffer[InlineCapacity] {};
+};
+
+template <size_t N>
+bool operator==(const small_byte_vector<N>& lhs, const small_byte_vector<N>& rhs)
+{
+    return std::equal(lhs.cbegin(), lhs.cend(), rhs.cbegin(), rhs.cend());
+}
+
+template <size_t N>
+bool operator==(const small_byte_vector<N>& lhs, const std::vector<unsigned char>& rhs)
+{
+    return std::equal(lhs.cbegin(), lhs.cend(), rhs.cbegin(), rhs.cend());
+}
+
+template <size_t N>
+bool operator==(const std::vector<unsigned char>& lhs, const small_byte_vector<N>& rhs)
+{
+    return rhs == lhs;
+}
+
+template <size_t N>
+bool operator!=(const small_byte_vector<N>& lhs, const small_byte_vector<N>& rhs)
+{
+    return !(lhs == rhs);
+}
+
+template <size_t N>
+bool operator!=(const small_byte_vector<N>& lhs, const std::vector<unsigned char>& rhs)
+{
+    return !(lhs == rhs);
+}
+
+template <size_t N>
+bool operator!=(const std::vector<unsigned char>& lhs, const small_byte_vector<N>& rhs)
+{
+    return !(rhs == lhs);
+}
+
+} // namespace pcsc_cpp
@@ -5,4 +5,4 @@ set -u
 
 cd "$( dirname "$0" )/.."
 
-find src/ include/ tests/{integration,mock} -iname '*.hpp' -o -iname '*.h' -o -iname '*.cpp' | xargs clang-format -i
+find src/ include/ tests/{bench,integration,mock} tools/ -iname '*.hpp' -o -iname '*.h' -o -iname '*.cpp' | xargs clang-format -i
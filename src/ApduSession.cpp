@@ -0,0 +1,286 @@
+/*
+ * Copyright (c) 2020-2023 Estonian Information System Authority
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "ApduSession.hpp"
+
+#include "pcsc-cpp/pcsc-cpp-utils.hpp"
+
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <thread>
+
+namespace
+{
+
+using namespace pcsc_cpp;
+
+constexpr char MAGIC[] = "PCSCSESS";
+constexpr size_t MAGIC_SIZE = sizeof(MAGIC) - 1;
+
+void writeVarint(byte_vector& out, uint64_t value)
+{
+    while (value >= 0x80) {
+        out.push_back(byte_type(value | 0x80));
+        value >>= 7;
+    }
+    out.push_back(byte_type(value));
+}
+
+void writeBytes(byte_vector& out, const byte_vector& bytes)
+{
+    writeVarint(out, bytes.size());
+    out.insert(out.end(), bytes.cbegin(), bytes.cend());
+}
+
+class ByteReader
+{
+public:
+    ByteReader(const byte_vector& data, const size_t position) : data(data), position(position) {}
+
+    bool atEnd() const { return position == data.size(); }
+
+    byte_type byte()
+    {
+        if (atEnd()) {
+            THROW(Error, "ApduSession: unexpected end of data");
+        }
+        return data[position++];
+    }
+
+    uint64_t varint()
+    {
+        uint64_t value = 0;
+        for (unsigned shift = 0; shift < 64; shift += 7) {
+            const auto next = byte();
+            value |= uint64_t(next & 0x7f) << shift;
+            if (!(next & 0x80)) {
+                return value;
+            }
+        }
+        THROW(Error, "ApduSession: varint is too long");
+    }
+
+    uint32_t varint32()
+    {
+        const auto value = varint();
+        if (value > std::numeric_limits<uint32_t>::max()) {
+            THROW(Error, "ApduSession: value does not fit 32 bits");
+        }
+        return uint32_t(value);
+    }
+
+    size_t size()
+    {
+        const auto value = varint();
+        if (value > data.size() - position) {
+            THROW(Error, "ApduSession: length exceeds the remaining data");
+        }
+        return size_t(value);
+    }
+
+    byte_vector bytes()
+    {
+        const auto count = size();
+        const auto begin = data.cbegin() + std::ptrdiff_t(position);
+        position += count;
+        return {begin, begin + std::ptrdiff_t(count)};
+    }
+
+private:
+    const byte_vector& data;
+    size_t position;
+};
+
+} // namespace
+
+namespace pcsc_cpp
+{
+
+byte_vector ApduSession::serialize() const
+{
+    byte_vector out(MAGIC, MAGIC + MAGIC_SIZE);
+    out.push_back(VERSION);
+
+    writeVarint(out, reader.size());
+    for (const auto codeUnit : reader) {
+        writeVarint(out, uint64_t(codeUnit));
+    }
+    writeBytes(out, atr);
+    out.push_back(byte_type(protocol));
+    writeVarint(out, readerFeatures.size());
+    for (const auto feature : readerFeatures) {
+        writeVarint(out, feature);
+    }
+
+    auto previousStart = std::chrono::microseconds {0};
+    for (const auto& exchange : exchanges) {
+        out.push_back(byte_type(exchange.kind));
+        if (exchange.kind == Exchange::Kind::CONTROL) {
+            writeVarint(out, exchange.controlCode);
+        }
+        writeVarint(out, exchange.result);
+        // Exchanges are recorded in order, clamp in case the session has been edited.
+        writeVarint(out, uint64_t(std::max(exchange.start - previousStart,
+                                           std::chrono::microseconds {0})
+                                      .count()));
+        previousStart = std::max(exchange.start, previousStart);
+        writeVarint(out, uint64_t(exchange.duration.count()));
+        writeBytes(out, exchange.command);
+        writeBytes(out, exchange.response);
+    }
+    return out;
+}
+
+ApduSession ApduSession::deserialize(const byte_vector& data)
+{
+    if (data.size() < MAGIC_SIZE + 1 || !std::equal(MAGIC, MAGIC + MAGIC_SIZE, data.cbegin())) {
+        THROW(Error, "ApduSession: data is not an APDU session");
+    }
+    if (data[MAGIC_SIZE] != VERSION) {
+        THROW(Error,
+              "ApduSession: unsupported format version " + std::to_string(data[MAGIC_SIZE]));
+    }
+    auto in = ByteReader {data, MAGIC_SIZE + 1};
+
+    ApduSession session;
+    const auto readerSize = in.size();
+    session.reader.reserve(readerSize);
+    for (size_t i = 0; i < readerSize; ++i) {
+        session.reader.push_back(string_t::value_type(in.varint32()));
+    }
+    session.atr = in.bytes();
+    const auto protocol = in.byte();
+    if (protocol > byte_type(SmartCard::Protocol::T1)) {
+        THROW(Error, "ApduSession: invalid protocol " + std::to_string(protocol));
+    }
+    session.protocol = SmartCard::Protocol(protocol);
+    session.readerFeatures.resize(in.size());
+    for (auto& feature : session.readerFeatures) {
+        feature = in.varint32();
+    }
+
+    auto start = std::chrono::microseconds {0};
+    while (!in.atEnd()) {
+        Exchange exchange;
+        const auto kind = in.byte();
+        if (kind != byte_type(Exchange::Kind::TRANSMIT)
+            && kind != byte_type(Exchange::Kind::CONTROL)) {
+            THROW(Error, "ApduSession: invalid exchange kind " + std::to_string(kind));
+        }
+        exchange.kind = Exchange::Kind(kind);
+        if (exchange.kind == Exchange::Kind::CONTROL) {
+            exchange.controlCode = in.varint32();
+        }
+        exchange.result = in.varint32();
+        start += std::chrono::microseconds(in.varint());
+        exchange.start = start;
+        exchange.duration = std::chrono::microseconds(in.varint());
+        exchange.command = in.bytes();
+        exchange.response = in.bytes();
+        session.exchanges.push_back(std::move(exchange));
+    }
+    return session;
+}
+
+void ApduSession::save(const std::string& filePath) const
+{
+    const auto data = serialize();
+    std::ofstream file(filePath, std::ios::binary | std::ios::trunc);
+    file.write(reinterpret_cast<const char*>(data.data()), std::streamsize(data.size()));
+    if (!file) {
+        THROW(SystemError, "ApduSession: cannot write file '" + filePath + "'");
+    }
+}
+
+ApduSession ApduSession::load(const std::string& filePath)
+{
+    std::ifstream file(filePath, std::ios::binary);
+    if (!file) {
+        THROW(SystemError, "ApduSession: cannot open file '" + filePath + "'");
+    }
+    const auto data =
+        byte_vector(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+    if (file.bad()) {
+        THROW(SystemError, "ApduSession: cannot read file '" + filePath + "'");
+    }
+    return deserialize(data);
+}
+
+void ApduSessionRecording::record(const ApduSession::Exchange::Kind kind,
+                                  const uint32_t controlCode, const LONG result,
+                                  const Clock::time_point start, const byte_type* command,
+                                  const size_t commandSize, const byte_type* response,
+                                  const size_t responseSize)
+{
+    using std::chrono::duration_cast;
+    using std::chrono::microseconds;
+
+    ApduSession::Exchange exchange;
+    exchange.kind = kind;
+    exchange.controlCode = controlCode;
+    exchange.result = uint32_t(result);
+    exchange.start = duration_cast<microseconds>(start - sessionStart);
+    exchange.duration = duration_cast<microseconds>(Clock::now() - start);
+    if (command) {
+        exchange.command.assign(command, command + commandSize);
+    }
+    if (result == SCARD_S_SUCCESS && response) {
+        exchange.response.assign(response, response + responseSize);
+    }
+    session.exchanges.push_back(std::move(exchange));
+}
+
+LONG ApduSessionReplay::next(const ApduSession::Exchange::Kind kind, const uint32_t controlCode,
+                             const byte_type* command, const size_t commandSize,
+                             byte_type* response, DWORD* responseSize)
+{
+    if (position == session.exchanges.size()) {
+        THROW(Error, "ApduSession replay: no more recorded exchanges");
+    }
+    const auto& exchange = session.exchanges[position];
+    if (exchange.kind != kind || exchange.controlCode != controlCode
+        || exchange.command.size() != commandSize
+        || !std::equal(exchange.command.cbegin(), exchange.command.cend(), command)) {
+        THROW(Error,
+              "ApduSession replay: command "
+                  + bytes2hexstr(byte_vector(command, command + commandSize))
+                  + " differs from recorded exchange " + std::to_string(position) + ' '
+                  + bytes2hexstr(exchange.command));
+    }
+    ++position;
+
+    if (pace == SmartCard::ReplayPace::RECORDED) {
+        std::this_thread::sleep_for(exchange.duration);
+    }
+    if (exchange.result != SCARD_S_SUCCESS) {
+        return LONG(exchange.result);
+    }
+    if (*responseSize < exchange.response.size()) {
+        return LONG(SCARD_E_INSUFFICIENT_BUFFER);
+    }
+    std::copy(exchange.response.cbegin(), exchange.response.cend(), response);
+    *responseSize = DWORD(exchange.response.size());
+    return SCARD_S_SUCCESS;
+}
+
+} // namespace pcsc_cpp
@@ -0,0 +1,76 @@
+/*
+ * Copyright (c) 2020-2023 Estonian Information System Authority
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#pragma once
+
+#include "pcsc-cpp/pcsc-cpp.hpp"
+#include "pcsc-cpp/comp_winscard.hpp"
+
+#include <chrono>
+
+namespace pcsc_cpp
+{
+
+/** Collects the SCardTransmit() and SCardControl() calls of a card into a session. */
+class ApduSessionRecording
+{
+public:
+    using Clock = std::chrono::steady_clock;
+
+    explicit ApduSessionRecording(ApduSession session) : session(std::move(session)) {}
+
+    void record(ApduSession::Exchange::Kind kind, uint32_t controlCode, LONG result,
+                Clock::time_point start, const byte_type* command, size_t commandSize,
+                const byte_type* response, size_t responseSize);
+
+    ApduSession session;
+
+private:
+    const Clock::time_point sessionStart = Clock::now();
+};
+
+/** Serves the recorded responses of a session in the recorded order. */
+class ApduSessionReplay
+{
+public:
+    ApduSessionReplay(ApduSession session, SmartCard::ReplayPace pace) :
+        session(std::move(session)), pace(pace)
+    {
+    }
+
+    /**
+     * Return the recorded result and copy the recorded response to response like SCardTransmit()
+     * and SCardControl() do, responseSize is the buffer size on input.
+     *
+     * @throw Error if the call differs from the next recorded call.
+     */
+    LONG next(ApduSession::Exchange::Kind kind, uint32_t controlCode, const byte_type* command,
+              size_t commandSize, byte_type* response, DWORD* responseSize);
+
+    const ApduSession session;
+
+private:
+    const SmartCard::ReplayPace pace;
+    size_t position = 0;
+};
+
+} // namespace pcsc_cpp
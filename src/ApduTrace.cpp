@@ -0,0 +1,240 @@
+/*
+ * Copyright (c) 2020-2023 Estonian Information System Authority
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "ApduTrace.hpp"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <mutex>
+
+namespace pcsc_cpp
+{
+
+namespace
+{
+
+constexpr size_t WORD_SIZE = sizeof(uint64_t);
+constexpr size_t WORD_COUNT = ApduTraceRecord::FLIGHT_RECORDER_MAX_BYTES / WORD_SIZE;
+
+using Words = std::array<std::atomic<uint64_t>, WORD_COUNT>;
+
+/**
+ * Flight recorder slot protected by a sequence lock, the sequence is odd while a writer updates
+ * the slot. All fields are atomics so that readers never race with writers. The fields are
+ * stored with release and loaded with acquire ordering instead of using fences: a reader that
+ * sees any new field value also sees the odd sequence. On x86 these are plain moves.
+ */
+struct Slot
+{
+    std::atomic<uint64_t> sequence {};
+    std::atomic<uint64_t> recordIndex {};
+    std::atomic<int64_t> timestamp {};
+    std::atomic<int64_t> durationMicros {};
+    std::atomic<uint64_t> readerSize {};
+    std::atomic<uint64_t> commandSize {};
+    std::atomic<uint64_t> responseSize {};
+    Words reader {};
+    Words command {};
+    Words response {};
+};
+
+/** Store size bytes of data, wide strings are stored with all bytes of their characters. */
+void storeBytes(Words& words, const void* data, const size_t size)
+{
+    const auto* bytes = static_cast<const uint8_t*>(data);
+    const auto count = std::min(size, ApduTraceRecord::FLIGHT_RECORDER_MAX_BYTES);
+    for (size_t word = 0; word * WORD_SIZE < count; ++word) {
+        uint64_t value = 0;
+        for (size_t i = 0; i < WORD_SIZE && word * WORD_SIZE + i < count; ++i) {
+            value |= uint64_t(bytes[word * WORD_SIZE + i]) << (8 * i);
+        }
+        words[word].store(value, std::memory_order_release);
+    }
+}
+
+/** Load size bytes into a container of whole elements, a truncated last element is dropped. */
+template <typename Container>
+Container loadBytes(const Words& words, const size_t size)
+{
+    using value_type = typename Container::value_type;
+    const auto count = std::min(size, ApduTraceRecord::FLIGHT_RECORDER_MAX_BYTES);
+    Container result(count / sizeof(value_type), 0);
+    auto* bytes = reinterpret_cast<uint8_t*>(result.data());
+    for (size_t i = 0; i < result.size() * sizeof(value_type); ++i) {
+        const auto value = words[i / WORD_SIZE].load(std::memory_order_acquire);
+        bytes[i] = uint8_t(value >> (8 * (i % WORD_SIZE)));
+    }
+    return result;
+}
+
+class FlightRecorder
+{
+public:
+    void record(const ApduExchange& exchange) noexcept
+    {
+        const auto index = nextIndex.fetch_add(1, std::memory_order_relaxed);
+        auto& slot = slots[index % slots.size()];
+
+        // Drop the record if another writer is still updating the slot after a wrap-around.
+        auto sequence = slot.sequence.load(std::memory_order_relaxed);
+        if ((sequence & 1)
+            || !slot.sequence.compare_exchange_strong(sequence, sequence + 1,
+                                                      std::memory_order_acquire)) {
+            return;
+        }
+
+        slot.recordIndex.store(index, std::memory_order_release);
+        slot.timestamp.store(exchange.timestamp.time_since_epoch().count(),
+                             std::memory_order_release);
+        slot.durationMicros.store(exchange.duration.count(), std::memory_order_release);
+        // Reader names are wide strings on Windows, the size is in bytes.
+        const auto readerSize = exchange.reader->size() * sizeof(string_t::value_type);
+        slot.readerSize.store(readerSize, std::memory_order_release);
+        slot.commandSize.store(exchange.commandSize, std::memory_order_release);
+        slot.responseSize.store(exchange.responseSize, std::memory_order_release);
+        storeBytes(slot.reader, exchange.reader->data(), readerSize);
+        storeBytes(slot.command, exchange.command, exchange.commandSize);
+        storeBytes(slot.response, exchange.response, exchange.responseSize);
+
+        slot.sequence.store(sequence + 2, std::memory_order_release);
+    }
+
+    std::vector<ApduTraceRecord> snapshot() const
+    {
+        std::vector<std::pair<uint64_t, ApduTraceRecord>> records;
+        records.reserve(slots.size());
+
+        for (const auto& slot : slots) {
+            const auto sequence = slot.sequence.load(std::memory_order_acquire);
+            if (sequence == 0 || (sequence & 1)) {
+                continue;
+            }
+            const auto index = slot.recordIndex.load(std::memory_order_acquire);
+            ApduTraceRecord record;
+            record.timestamp = std::chrono::system_clock::time_point(
+                std::chrono::system_clock::duration(
+                    slot.timestamp.load(std::memory_order_acquire)));
+            record.duration =
+                std::chrono::microseconds(slot.durationMicros.load(std::memory_order_acquire));
+            record.reader = loadBytes<string_t>(
+                slot.reader, size_t(slot.readerSize.load(std::memory_order_acquire)));
+            record.commandSize = size_t(slot.commandSize.load(std::memory_order_acquire));
+            record.command = loadBytes<byte_vector>(slot.command, record.commandSize);
+            record.responseSize = size_t(slot.responseSize.load(std::memory_order_acquire));
+            record.response = loadBytes<byte_vector>(slot.response, record.responseSize);
+
+            // Skip the slot if a writer has modified it while it was read.
+            if (slot.sequence.load(std::memory_order_relaxed) != sequence) {
+                continue;
+            }
+            records.emplace_back(index, std::move(record));
+        }
+
+        std::sort(records.begin(), records.end(),
+                  [](const auto& a, const auto& b) { return a.first < b.first; });
+        std::vector<ApduTraceRecord> result;
+        result.reserve(records.size());
+        for (auto& record : records) {
+            result.push_back(std::move(record.second));
+        }
+        return result;
+    }
+
+private:
+    std::atomic<uint64_t> nextIndex {};
+    std::array<Slot, ApduTraceRecord::FLIGHT_RECORDER_SIZE> slots {};
+};
+
+FlightRecorder flightRecorder;
+
+std::atomic<bool> sinkInstalled {false};
+std::mutex sinkMutex;
+std::shared_ptr<ApduTraceSink> traceSink;
+
+std::mutex dumpHandlerMutex;
+FlightRecorderDumpHandler dumpHandler;
+
+} // namespace
+
+void ApduTrace::record(const byte_type* response, const size_t responseSize) noexcept
+{
+    const auto exchange = ApduExchange {
+        timestamp,
+        std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now()
+                                                              - start),
+        &reader,
+        command,
+        commandSize,
+        response,
+        responseSize};
+
+    flightRecorder.record(exchange);
+
+    if (!sinkInstalled.load(std::memory_order_relaxed)) {
+        return;
+    }
+    try {
+        std::shared_ptr<ApduTraceSink> sink;
+        {
+            std::lock_guard<std::mutex> lock(sinkMutex);
+            sink = traceSink;
+        }
+        if (sink) {
+            sink->onExchange(exchange);
+        }
+    } catch (...) {
+        // Tracing must not affect the transmit.
+    }
+}
+
+void dumpFlightRecorder(const Error& error) noexcept
+{
+    try {
+        std::lock_guard<std::mutex> lock(dumpHandlerMutex);
+        if (dumpHandler) {
+            dumpHandler(error, flightRecorder.snapshot());
+        }
+    } catch (...) {
+        // The original error is more important than a failed dump.
+    }
+}
+
+void setApduTraceSink(std::shared_ptr<ApduTraceSink> sink)
+{
+    std::lock_guard<std::mutex> lock(sinkMutex);
+    sinkInstalled = sink != nullptr;
+    traceSink = std::move(sink);
+}
+
+void setFlightRecorderDumpHandler(FlightRecorderDumpHandler handler)
+{
+    std::lock_guard<std::mutex> lock(dumpHandlerMutex);
+    dumpHandler = std::move(handler);
+}
+
+std::vector<ApduTraceRecord> flightRecorderSnapshot()
+{
+    return flightRecorder.snapshot();
+}
+
+} // namespace pcsc_cpp
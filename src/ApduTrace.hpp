@@ -0,0 +1,73 @@
+/*
+ * Copyright (c) 2020-2023 Estonian Information System Authority
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#pragma once
+
+#include "pcsc-cpp/pcsc-cpp.hpp"
+
+#include <chrono>
+
+namespace pcsc_cpp
+{
+
+/**
+ * Records one APDU exchange in the flight recorder and passes it to the trace sink. An exchange
+ * that is not completed, because the transmit failed, is recorded without response.
+ */
+class ApduTrace
+{
+public:
+    ApduTrace(const string_t& reader, const byte_type* command, size_t commandSize) :
+        reader(reader), command(command), commandSize(commandSize)
+    {
+    }
+
+    ~ApduTrace()
+    {
+        if (!completed) {
+            record(nullptr, 0);
+        }
+    }
+
+    PCSC_CPP_DISABLE_COPY_MOVE(ApduTrace);
+
+    void complete(const byte_type* response, const size_t responseSize)
+    {
+        completed = true;
+        record(response, responseSize);
+    }
+
+private:
+    void record(const byte_type* response, size_t responseSize) noexcept;
+
+    const string_t& reader;
+    const byte_type* command;
+    const size_t commandSize;
+    const std::chrono::system_clock::time_point timestamp = std::chrono::system_clock::now();
+    const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    bool completed = false;
+};
+
+/** Pass the flight recorder contents to the dump handler if one is installed. */
+void dumpFlightRecorder(const Error& error) noexcept;
+
+} // namespace pcsc_cpp
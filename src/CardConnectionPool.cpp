@@ -0,0 +1,158 @@
+/*
+ * Copyright (c) 2020-2023 Estonian Information System Authority
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "pcsc-cpp/pcsc-cpp.hpp"
+#include "pcsc-cpp/pcsc-cpp-utils.hpp"
+
+#include <list>
+#include <mutex>
+
+namespace pcsc_cpp
+{
+
+class CardConnectionPool::Impl
+{
+public:
+    explicit Impl(const size_t maxIdle) : maxIdleCards(maxIdle) {}
+
+    SmartCard::ptr take(const Reader& reader)
+    {
+        SmartCard::ptr card;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            const auto idle = std::find_if(idleCards.begin(), idleCards.end(),
+                                           [&reader](const auto& entry) {
+                                               return entry.first == reader.name
+                                                   && entry.second->atr() == reader.cardAtr;
+                                           });
+            if (idle == idleCards.end()) {
+                return {};
+            }
+            card = std::move(idle->second);
+            idleCards.erase(idle);
+        }
+        // The health check and disconnect of an evicted card run outside the lock.
+        if (!card->isConnected()) {
+            card.reset();
+        }
+        return card;
+    }
+
+    void put(string_t readerName, SmartCard::ptr card)
+    {
+        SmartCard::ptr evicted;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            // Most recently used first.
+            idleCards.emplace_front(std::move(readerName), std::move(card));
+            if (idleCards.size() > maxIdleCards) {
+                evicted = std::move(idleCards.back().second);
+                idleCards.pop_back();
+            }
+        }
+    }
+
+    size_t idleCount() const
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        return idleCards.size();
+    }
+
+    void clear()
+    {
+        std::list<std::pair<string_t, SmartCard::ptr>> disconnected;
+        std::lock_guard<std::mutex> lock(mutex);
+        disconnected.swap(idleCards);
+    }
+
+private:
+    const size_t maxIdleCards;
+
+    mutable std::mutex mutex;
+    std::list<std::pair<string_t, SmartCard::ptr>> idleCards;
+};
+
+CardConnectionPool::Lease::Lease(std::weak_ptr<Impl> p, string_t name, SmartCard::ptr c) :
+    pool(std::move(p)), readerName(std::move(name)), card(std::move(c))
+{
+}
+
+CardConnectionPool::Lease::~Lease()
+{
+    release();
+}
+
+CardConnectionPool::Lease::Lease(Lease&& other) noexcept = default;
+
+CardConnectionPool::Lease& CardConnectionPool::Lease::operator=(Lease&& other) noexcept
+{
+    if (this != &other) {
+        release();
+        pool = std::move(other.pool);
+        readerName = std::move(other.readerName);
+        card = std::move(other.card);
+    }
+    return *this;
+}
+
+void CardConnectionPool::Lease::release() noexcept
+{
+    if (!card) {
+        return;
+    }
+    try {
+        if (auto p = pool.lock()) {
+            p->put(std::move(readerName), std::move(card));
+        }
+    } catch (...) {
+        // Ignore exceptions in destructor, the card is disconnected.
+    }
+    card.reset();
+}
+
+CardConnectionPool::CardConnectionPool(size_t maxIdleCards) :
+    impl(std::make_shared<Impl>(maxIdleCards))
+{
+}
+
+CardConnectionPool::~CardConnectionPool() = default;
+
+CardConnectionPool::Lease CardConnectionPool::acquire(const Reader& reader)
+{
+    auto card = impl->take(reader);
+    if (!card) {
+        card = reader.connectToCard();
+    }
+    return {impl, reader.name, std::move(card)};
+}
+
+size_t CardConnectionPool::idleCount() const
+{
+    return impl->idleCount();
+}
+
+void CardConnectionPool::clear()
+{
+    impl->clear();
+}
+
+} // namespace pcsc_cpp
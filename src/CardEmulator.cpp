@@ -0,0 +1,974 @@
+/*
+ * Copyright (c) 2020-2023 Estonian Information System Authority
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "pcsc-cpp/pcsc-backend.hpp"
+
+#include "pcsc-cpp/pcsc-cpp-utils.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <thread>
+
+namespace
+{
+
+using namespace pcsc_cpp;
+
+#ifdef _WIN32
+const string_t PNP_NOTIFICATION = L"\\\\?PnP?\\Notification";
+#else
+const string_t PNP_NOTIFICATION = "\\\\?PnP?\\Notification";
+#endif
+
+// Status words, see ISO/IEC 7816-4 section 5.6.
+constexpr uint16_t SW_OK = 0x9000;
+constexpr uint16_t SW_END_OF_FILE = 0x6282;
+constexpr uint16_t SW_WRONG_LENGTH = 0x6700;
+constexpr uint16_t SW_CHAINING_NOT_SUPPORTED = 0x6884;
+constexpr uint16_t SW_INCOMPATIBLE_FILE = 0x6981;
+constexpr uint16_t SW_CONDITIONS_NOT_SATISFIED = 0x6985;
+constexpr uint16_t SW_NO_CURRENT_EF = 0x6986;
+constexpr uint16_t SW_FILE_NOT_FOUND = 0x6a82;
+constexpr uint16_t SW_NOT_ENOUGH_MEMORY = 0x6a84;
+constexpr uint16_t SW_INCORRECT_P1_P2 = 0x6a86;
+constexpr uint16_t SW_LC_INCONSISTENT = 0x6a87;
+constexpr uint16_t SW_WRONG_OFFSET = 0x6b00;
+constexpr uint16_t SW_INS_NOT_SUPPORTED = 0x6d00;
+constexpr uint16_t SW_CLA_NOT_SUPPORTED = 0x6e00;
+
+constexpr byte_type CLA_PROPRIETARY = 0x80;
+constexpr byte_type CLA_CHAINING = 0x10;
+constexpr byte_type INS_SELECT = 0xa4;
+constexpr byte_type INS_READ_BINARY = 0xb0;
+constexpr byte_type INS_GET_RESPONSE = 0xc0;
+constexpr byte_type INS_UPDATE_BINARY = 0xd6;
+
+constexpr uint16_t MF_ID = 0x3f00;
+
+/** Command APDU fields, see ISO/IEC 7816-4 section 5.1. */
+struct ParsedCommand
+{
+    byte_type cla;
+    byte_type ins;
+    byte_type p1;
+    byte_type p2;
+    // Short command data stays inline, the emulator does not allocate for common commands.
+    apdu_byte_vector data;
+    // Ne, 0 when Le is absent.
+    size_t ne = 0;
+    bool extended = false;
+};
+
+std::optional<ParsedCommand> parseCommand(const byte_type* bytes, const size_t size)
+{
+    if (size < 4) {
+        return {};
+    }
+    auto command = ParsedCommand {bytes[0], bytes[1], bytes[2], bytes[3], {}, 0, false};
+    const auto* body = bytes + 4;
+    const auto bodySize = size - 4;
+
+    if (bodySize == 0) {
+        return command;
+    }
+    if (bodySize == 1) {
+        command.ne = body[0] ? body[0] : 256;
+        return command;
+    }
+    if (body[0] != 0) {
+        const size_t nc = body[0];
+        if (bodySize != 1 + nc && bodySize != 2 + nc) {
+            return {};
+        }
+        command.data.assign(body + 1, body + 1 + nc);
+        if (bodySize == 2 + nc) {
+            command.ne = body[1 + nc] ? body[1 + nc] : 256;
+        }
+        return command;
+    }
+
+    command.extended = true;
+    if (bodySize == 3) {
+        const size_t le = size_t(body[1]) << 8 | body[2];
+        command.ne = le ? le : 65536;
+        return command;
+    }
+    const size_t nc = bodySize > 3 ? size_t(body[1]) << 8 | body[2] : 0;
+    if (nc == 0 || (bodySize != 3 + nc && bodySize != 5 + nc)) {
+        return {};
+    }
+    command.data.assign(body + 3, body + 3 + nc);
+    if (bodySize == 5 + nc) {
+        const size_t le = size_t(body[3 + nc]) << 8 | body[4 + nc];
+        command.ne = le ? le : 65536;
+    }
+    return command;
+}
+
+struct Response
+{
+    apdu_byte_vector data;
+    uint16_t sw = SW_OK;
+};
+
+Response status(const uint16_t sw)
+{
+    return {{}, sw};
+}
+
+/** Current DF as the path of DFs from the MF and the current EF, see ISO/IEC 7816-4 7.2.1. */
+struct Selection
+{
+    std::vector<EmulatedFile*> path;
+    EmulatedFile* ef = nullptr;
+    // Path that SELECT builds, swapped with path on success so that both keep their capacity.
+    std::vector<EmulatedFile*> candidatePath;
+};
+
+/** Inserted card, the file system is shared by all connections to the card. */
+struct CardState
+{
+    explicit CardState(EmulatedCard c) : card(std::move(c)) {}
+
+    EmulatedCard card;
+    std::atomic<bool> removed {false};
+
+    // Guards the file system, the connection states and the transaction owner.
+    std::mutex mutex;
+    std::condition_variable transactionEnded;
+    SCARDHANDLE transactionOwner = 0;
+};
+
+struct Connection
+{
+    string_t reader;
+    std::shared_ptr<CardState> card;
+    Selection selection;
+    // Response data that is returned with GET RESPONSE and the status word after it.
+    byte_vector pendingData;
+    uint16_t pendingSw = SW_OK;
+};
+
+struct EmulatedReader
+{
+    std::shared_ptr<CardState> card;
+    // Card insertion and removal counter, reported in the upper 16 bits of the reader state like
+    // pcsc-lite does.
+    DWORD eventCounter = 0;
+};
+
+struct Emulator
+{
+    std::mutex mutex;
+    std::condition_variable stateChanged;
+    std::map<string_t, EmulatedReader> readers;
+    // Reported in the plug-and-play notification state, never 0 so that the state is not
+    // mistaken for SCARD_STATE_UNAWARE.
+    DWORD readerListVersion = 1;
+    // Context handles and whether SCardCancel() has been called.
+    std::map<SCARDCONTEXT, bool> contexts;
+    std::map<SCARDHANDLE, std::shared_ptr<Connection>> connections;
+    uintptr_t nextHandle = 1;
+};
+
+Emulator& emulator()
+{
+    static Emulator instance;
+    return instance;
+}
+
+std::shared_ptr<Connection> findConnection(const SCARDHANDLE handle)
+{
+    auto& e = emulator();
+    std::lock_guard<std::mutex> lock(e.mutex);
+    const auto connection = e.connections.find(handle);
+    return connection == e.connections.cend() ? nullptr : connection->second;
+}
+
+void markRemoved(const std::shared_ptr<CardState>& card)
+{
+    {
+        std::lock_guard<std::mutex> lock(card->mutex);
+        card->removed = true;
+    }
+    card->transactionEnded.notify_all();
+}
+
+DWORD scardProtocol(const SmartCard::Protocol protocol)
+{
+    switch (protocol) {
+    case SmartCard::Protocol::T0:
+        return SCARD_PROTOCOL_T0;
+    case SmartCard::Protocol::T1:
+        return SCARD_PROTOCOL_T1;
+    default:
+        return SCARD_PROTOCOL_UNDEFINED;
+    }
+}
+
+template <typename T>
+LONG copyToBuffer(const T* data, const size_t size, T* buffer, LPDWORD bufferLength)
+{
+    if (!bufferLength) {
+        return SCARD_S_SUCCESS;
+    }
+    if (buffer && *bufferLength < size) {
+        *bufferLength = DWORD(size);
+        return SCARD_E_INSUFFICIENT_BUFFER;
+    }
+    if (buffer) {
+        std::copy(data, data + size, buffer);
+    }
+    *bufferLength = DWORD(size);
+    return SCARD_S_SUCCESS;
+}
+
+// File system commands.
+
+EmulatedFile* findChild(EmulatedFile& df, const uint16_t id)
+{
+    const auto child = std::find_if(df.children.begin(), df.children.end(),
+                                    [id](const EmulatedFile& file) { return file.id == id; });
+    return child == df.children.end() ? nullptr : &*child;
+}
+
+bool findDfByName(std::vector<EmulatedFile*>& path, const apdu_byte_vector& dfName)
+{
+    if (path.back()->dfName == dfName) {
+        return true;
+    }
+    for (auto& child : path.back()->children) {
+        if (!child.isDedicated) {
+            continue;
+        }
+        path.push_back(&child);
+        if (findDfByName(path, dfName)) {
+            return true;
+        }
+        path.pop_back();
+    }
+    return false;
+}
+
+/** Make file the current DF or EF, the candidate path leads to the DF that contains it. */
+void selectFile(Selection& selection, EmulatedFile& file)
+{
+    auto& path = selection.candidatePath;
+    if (file.isDedicated) {
+        if (path.back() != &file) {
+            path.push_back(&file);
+        }
+        selection.ef = nullptr;
+    } else {
+        selection.ef = &file;
+    }
+    selection.path.swap(path);
+}
+
+byte_vector fileControlInformation(const EmulatedFile& file, const byte_type p2)
+{
+    // P2 bits 3 and 4 select FCI, FCP or FMD, see ISO/IEC 7816-4 table 40.
+    static constexpr byte_type TEMPLATE_TAGS[] = {0x6f, 0x62, 0x64};
+    const auto tag = TEMPLATE_TAGS[(p2 >> 2) & 0x03];
+    auto fci = byte_vector {};
+    if (tag != 0x64) {
+        if (!file.isDedicated) {
+            const auto size = std::min(file.content.size(), size_t(0xffff));
+            fci.insert(fci.end(), {0x80, 0x02, byte_type(size >> 8), byte_type(size)});
+        }
+        // DF or working transparent EF, see ISO/IEC 7816-4 table 12.
+        fci.insert(fci.end(),
+                   {0x82, 0x01, byte_type(file.isDedicated ? 0x38 : 0x01), 0x83, 0x02,
+                    byte_type(file.id >> 8), byte_type(file.id)});
+        if (!file.dfName.empty()) {
+            fci.insert(fci.end(), {0x84, byte_type(file.dfName.size())});
+            fci.insert(fci.end(), file.dfName.cbegin(), file.dfName.cend());
+        }
+    }
+    fci.insert(fci.begin(), {tag, byte_type(fci.size())});
+    return fci;
+}
+
+Response select(Selection& selection, EmulatedFile& masterFile, const ParsedCommand& command)
+{
+    const auto& data = command.data;
+    const auto fileId = [&data](const size_t offset) {
+        return uint16_t(data[offset] << 8 | data[offset + 1]);
+    };
+    auto& path = selection.candidatePath;
+    path = selection.path;
+    EmulatedFile* file = nullptr;
+
+    switch (command.p1) {
+    case 0x00: // MF, DF or EF by file identifier.
+        if (data.empty() || (data.size() == 2 && fileId(0) == MF_ID)) {
+            path = {&masterFile};
+            file = &masterFile;
+            break;
+        }
+        if (data.size() != 2) {
+            return status(SW_LC_INCONSISTENT);
+        }
+        file = findChild(*path.back(), fileId(0));
+        if (!file && path.size() > 1) {
+            // Search the siblings of the current DF.
+            path.pop_back();
+            file = findChild(*path.back(), fileId(0));
+        }
+        break;
+    case 0x01: // Child DF.
+    case 0x02: // EF under the current DF.
+        if (data.size() != 2) {
+            return status(SW_LC_INCONSISTENT);
+        }
+        file = findChild(*path.back(), fileId(0));
+        if (file && file->isDedicated != (command.p1 == 0x01)) {
+            file = nullptr;
+        }
+        break;
+    case 0x03: // Parent DF of the current DF.
+        if (!data.empty()) {
+            return status(SW_LC_INCONSISTENT);
+        }
+        if (path.size() > 1) {
+            path.pop_back();
+        }
+        file = path.back();
+        break;
+    case 0x04: // DF name.
+        path = {&masterFile};
+        if (!data.empty() && findDfByName(path, data)) {
+            file = path.back();
+        }
+        break;
+    case 0x08: // Path from the MF.
+    case 0x09: // Path from the current DF.
+        if (data.empty() || data.size() % 2) {
+            return status(SW_LC_INCONSISTENT);
+        }
+        if (command.p1 == 0x08) {
+            path = {&masterFile};
+        }
+        for (size_t offset = 0; offset < data.size(); offset += 2) {
+            if (file) {
+                if (!file->isDedicated) {
+                    return status(SW_FILE_NOT_FOUND);
+                }
+                path.push_back(file);
+            }
+            file = findChild(*path.back(), fileId(offset));
+            if (!file) {
+                break;
+            }
+        }
+        break;
+    default:
+        return status(SW_INCORRECT_P1_P2);
+    }
+
+    if (!file) {
+        return status(SW_FILE_NOT_FOUND);
+    }
+    selectFile(selection, *file);
+
+    if ((command.p2 & 0x0c) == 0x0c) {
+        return status(SW_OK);
+    }
+    return {fileControlInformation(*file, command.p2), SW_OK};
+}
+
+/** Select the EF by short EF identifier if P1 bit 8 is set, returns the offset from P1-P2. */
+std::optional<size_t> binaryOffset(Selection& selection, const ParsedCommand& command)
+{
+    if (!(command.p1 & 0x80)) {
+        return size_t(command.p1 << 8 | command.p2);
+    }
+    const auto shortId = command.p1 & 0x1f;
+    auto& children = selection.path.back()->children;
+    const auto file = std::find_if(children.begin(), children.end(), [&](const EmulatedFile& f) {
+        return !f.isDedicated && (f.id & 0x1f) == shortId;
+    });
+    if (file == children.end()) {
+        return {};
+    }
+    selection.ef = &*file;
+    return size_t(command.p2);
+}
+
+Response readBinary(Selection& selection, const ParsedCommand& command)
+{
+    const auto offset = binaryOffset(selection, command);
+    if (!offset) {
+        return status(SW_FILE_NOT_FOUND);
+    }
+    if (!selection.ef) {
+        return status(SW_NO_CURRENT_EF);
+    }
+    if (command.ne == 0) {
+        return status(SW_WRONG_LENGTH);
+    }
+    const auto& content = selection.ef->content;
+    if (*offset > content.size()) {
+        return status(SW_WRONG_OFFSET);
+    }
+    const auto count = std::min(command.ne, content.size() - *offset);
+    const auto begin = content.cbegin() + std::ptrdiff_t(*offset);
+    return {apdu_byte_vector(begin, begin + std::ptrdiff_t(count)),
+            count < command.ne ? SW_END_OF_FILE : SW_OK};
+}
+
+Response updateBinary(Selection& selection, const ParsedCommand& command)
+{
+    const auto offset = binaryOffset(selection, command);
+    if (!offset) {
+        return status(SW_FILE_NOT_FOUND);
+    }
+    if (!selection.ef) {
+        return status(SW_NO_CURRENT_EF);
+    }
+    if (command.data.empty()) {
+        return status(SW_WRONG_LENGTH);
+    }
+    auto& content = selection.ef->content;
+    if (*offset > content.size()) {
+        return status(SW_WRONG_OFFSET);
+    }
+    if (command.data.size() > content.size() - *offset) {
+        return status(SW_NOT_ENOUGH_MEMORY);
+    }
+    std::copy(command.data.cbegin(), command.data.cend(),
+              content.begin() + std::ptrdiff_t(*offset));
+    return status(SW_OK);
+}
+
+Response getResponse(Connection& connection, const ParsedCommand& command)
+{
+    if (command.p1 || command.p2) {
+        return status(SW_INCORRECT_P1_P2);
+    }
+    if (connection.pendingData.empty()) {
+        return status(SW_CONDITIONS_NOT_SATISFIED);
+    }
+    if (command.ne == 0) {
+        return status(SW_WRONG_LENGTH);
+    }
+    auto& pending = connection.pendingData;
+    const auto count = std::min(command.ne, pending.size());
+    const auto end = pending.cbegin() + std::ptrdiff_t(count);
+    auto response = Response {apdu_byte_vector(pending.cbegin(), end), connection.pendingSw};
+    pending.erase(pending.cbegin(), end);
+    if (!pending.empty()) {
+        response.sw = uint16_t(ResponseApdu::MORE_DATA_AVAILABLE << 8)
+            | byte_type(std::min(pending.size(), ResponseApdu::MAX_DATA_SIZE));
+    }
+    return response;
+}
+
+/** Apply the transmission protocol rules to the response, returns the response bytes. */
+apdu_byte_vector encodeResponse(Connection& connection, const ParsedCommand& command,
+                                Response response)
+{
+    const auto moreData = [&connection](Response& r, const size_t sent) {
+        connection.pendingData.assign(r.data.cbegin() + std::ptrdiff_t(sent), r.data.cend());
+        connection.pendingSw = r.sw;
+        r.data.resize(sent);
+        r.sw = uint16_t(ResponseApdu::MORE_DATA_AVAILABLE << 8)
+            | byte_type(std::min(connection.pendingData.size(), ResponseApdu::MAX_DATA_SIZE));
+    };
+
+    if (connection.card->card.protocol == SmartCard::Protocol::T0 && !response.data.empty()) {
+        if (command.data.empty() && command.ne != response.data.size()) {
+            // Case 2 with wrong Le, the command is repeated with the available length as Le.
+            return {ResponseApdu::WRONG_LE_LENGTH, byte_type(response.data.size())};
+        }
+        if (!command.data.empty()) {
+            // Case 4, the data is fetched with GET RESPONSE.
+            moreData(response, 0);
+        }
+    } else if (command.ne == 0) {
+        // Case 1 and 3 commands return no data.
+        response.data.clear();
+    } else if (response.data.size() > command.ne) {
+        moreData(response, command.ne);
+    }
+
+    response.data.push_back(byte_type(response.sw >> 8));
+    response.data.push_back(byte_type(response.sw));
+    return std::move(response.data);
+}
+
+apdu_byte_vector processCommand(Connection& connection, const byte_type* bytes,
+                                const size_t size)
+{
+    const auto& card = connection.card->card;
+    const auto command = parseCommand(bytes, size);
+    if (!command) {
+        connection.pendingData.clear();
+        return {byte_type(SW_WRONG_LENGTH >> 8), byte_type(SW_WRONG_LENGTH)};
+    }
+    if (command->ins != INS_GET_RESPONSE) {
+        connection.pendingData.clear();
+    }
+
+    auto response = Response {};
+    if (command->extended
+        && (card.protocol == SmartCard::Protocol::T0 || !card.extendedLengthSupported)) {
+        response = status(SW_WRONG_LENGTH);
+    } else if (command->cla & CLA_PROPRIETARY) {
+        response = status(SW_CLA_NOT_SUPPORTED);
+    } else if (command->cla & CLA_CHAINING) {
+        response = status(SW_CHAINING_NOT_SUPPORTED);
+    } else {
+        auto& selection = connection.selection;
+        switch (command->ins) {
+        case INS_SELECT:
+            response = select(selection, connection.card->card.masterFile, *command);
+            break;
+        case INS_READ_BINARY:
+            response = selection.ef && selection.ef->isDedicated ? status(SW_INCOMPATIBLE_FILE)
+                                                                  : readBinary(selection, *command);
+            break;
+        case INS_UPDATE_BINARY:
+            response = updateBinary(selection, *command);
+            break;
+        case INS_GET_RESPONSE:
+            response = getResponse(connection, *command);
+            break;
+        default:
+            response = status(SW_INS_NOT_SUPPORTED);
+        }
+    }
+    return encodeResponse(connection, *command, std::move(response));
+}
+
+std::chrono::microseconds transmitTime(const EmulatedCard& card, const size_t byteCount)
+{
+    auto time = card.apduOverhead;
+    if (card.baudRate) {
+        // Start bit, 8 data bits, parity bit and the guard time of 2 or 1 bits.
+        const uint64_t bitsPerByte = card.protocol == SmartCard::Protocol::T0 ? 12 : 11;
+        time += std::chrono::microseconds(byteCount * bitsPerByte * 1000000 / card.baudRate);
+    }
+    return time;
+}
+
+// Backend functions.
+
+LONG emulatorEstablishContext(DWORD /* scope */, LPCVOID /* reserved1 */, LPCVOID /* reserved2 */,
+                              LPSCARDCONTEXT context)
+{
+    if (!context) {
+        return SCARD_E_INVALID_VALUE;
+    }
+    auto& e = emulator();
+    std::lock_guard<std::mutex> lock(e.mutex);
+    *context = SCARDCONTEXT(e.nextHandle++);
+    e.contexts.emplace(*context, false);
+    return SCARD_S_SUCCESS;
+}
+
+LONG emulatorReleaseContext(SCARDCONTEXT context)
+{
+    auto& e = emulator();
+    {
+        std::lock_guard<std::mutex> lock(e.mutex);
+        if (!e.contexts.erase(context)) {
+            return SCARD_E_INVALID_HANDLE;
+        }
+    }
+    e.stateChanged.notify_all();
+    return SCARD_S_SUCCESS;
+}
+
+LONG emulatorIsValidContext(SCARDCONTEXT context)
+{
+    auto& e = emulator();
+    std::lock_guard<std::mutex> lock(e.mutex);
+    return e.contexts.count(context) ? SCARD_S_SUCCESS : SCARD_E_INVALID_HANDLE;
+}
+
+LONG emulatorListReaders(SCARDCONTEXT context, const string_t::value_type* /* groups */,
+                         string_t::value_type* readers, LPDWORD readersLength)
+{
+    auto& e = emulator();
+    std::lock_guard<std::mutex> lock(e.mutex);
+    if (!e.contexts.count(context)) {
+        return SCARD_E_INVALID_HANDLE;
+    }
+    if (!readersLength || (readers && *readersLength == SCARD_AUTOALLOCATE)) {
+        return SCARD_E_INVALID_VALUE;
+    }
+    if (e.readers.empty()) {
+        return SCARD_E_NO_READERS_AVAILABLE;
+    }
+    // Reader names are \0 separated and end with double \0.
+    auto names = string_t {};
+    for (const auto& reader : e.readers) {
+        names += reader.first;
+        names.push_back(0);
+    }
+    names.push_back(0);
+    return copyToBuffer(names.data(), names.size(), readers, readersLength);
+}
+
+LONG emulatorGetStatusChange(SCARDCONTEXT context, DWORD timeout, SCARD_READERSTATE* states,
+                             DWORD stateCount)
+{
+    auto& e = emulator();
+    std::unique_lock<std::mutex> lock(e.mutex);
+    const auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout);
+
+    while (true) {
+        const auto contextState = e.contexts.find(context);
+        if (contextState == e.contexts.end()) {
+            return SCARD_E_INVALID_HANDLE;
+        }
+        if (contextState->second) {
+            contextState->second = false;
+            return SCARD_E_CANCELLED;
+        }
+
+        bool changed = false;
+        for (auto* state = states; state != states + stateCount; ++state) {
+            if (state->dwCurrentState & SCARD_STATE_IGNORE) {
+                state->dwEventState = SCARD_STATE_IGNORE;
+                continue;
+            }
+            DWORD eventState = SCARD_STATE_UNKNOWN;
+            state->cbAtr = 0;
+            const auto reader = e.readers.find(state->szReader);
+            if (state->szReader == PNP_NOTIFICATION) {
+                eventState = (e.readerListVersion & 0xffff) << 16;
+            } else if (reader != e.readers.cend()) {
+                const auto& card = reader->second.card;
+                eventState = (reader->second.eventCounter & 0xffff) << 16
+                    | (card ? SCARD_STATE_PRESENT : SCARD_STATE_EMPTY);
+                if (card) {
+                    state->cbAtr = DWORD(std::min(card->card.atr.size(), sizeof(state->rgbAtr)));
+                    std::copy_n(card->card.atr.cbegin(), state->cbAtr, state->rgbAtr);
+                }
+            }
+            const bool stateChanged = state->dwCurrentState == SCARD_STATE_UNAWARE
+                || (state->dwCurrentState & ~DWORD(SCARD_STATE_CHANGED)) != eventState;
+            state->dwEventState = eventState | (stateChanged ? SCARD_STATE_CHANGED : 0);
+            changed = changed || stateChanged;
+        }
+        if (changed) {
+            return SCARD_S_SUCCESS;
+        }
+
+        if (timeout == INFINITE) {
+            e.stateChanged.wait(lock);
+        } else if (std::chrono::steady_clock::now() >= deadline) {
+            return SCARD_E_TIMEOUT;
+        } else {
+            e.stateChanged.wait_until(lock, deadline);
+        }
+    }
+}
+
+LONG emulatorCancel(SCARDCONTEXT context)
+{
+    auto& e = emulator();
+    {
+        std::lock_guard<std::mutex> lock(e.mutex);
+        const auto contextState = e.contexts.find(context);
+        if (contextState == e.contexts.end()) {
+            return SCARD_E_INVALID_HANDLE;
+        }
+        contextState->second = true;
+    }
+    e.stateChanged.notify_all();
+    return SCARD_S_SUCCESS;
+}
+
+LONG emulatorConnect(SCARDCONTEXT context, const string_t::value_type* readerName,
+                     DWORD /* shareMode */, DWORD preferredProtocols, LPSCARDHANDLE handle,
+                     LPDWORD activeProtocol)
+{
+    if (!readerName || !handle || !activeProtocol) {
+        return SCARD_E_INVALID_VALUE;
+    }
+    auto& e = emulator();
+    std::lock_guard<std::mutex> lock(e.mutex);
+    if (!e.contexts.count(context)) {
+        return SCARD_E_INVALID_HANDLE;
+    }
+    const auto reader = e.readers.find(readerName);
+    if (reader == e.readers.cend()) {
+        return SCARD_E_READER_UNAVAILABLE;
+    }
+    const auto& card = reader->second.card;
+    if (!card) {
+        return SCARD_E_NO_SMARTCARD;
+    }
+    const auto protocol = scardProtocol(card->card.protocol);
+    if (!(preferredProtocols & protocol)) {
+        return SCARD_E_INVALID_VALUE;
+    }
+
+    auto connection = std::make_shared<Connection>();
+    connection->reader = reader->first;
+    connection->card = card;
+    connection->selection.path = {&card->card.masterFile};
+
+    *handle = SCARDHANDLE(e.nextHandle++);
+    *activeProtocol = protocol;
+    e.connections.emplace(*handle, std::move(connection));
+    return SCARD_S_SUCCESS;
+}
+
+LONG emulatorEndTransaction(SCARDHANDLE handle, DWORD /* disposition */);
+
+LONG emulatorDisconnect(SCARDHANDLE handle, DWORD disposition)
+{
+    emulatorEndTransaction(handle, disposition);
+    auto& e = emulator();
+    std::lock_guard<std::mutex> lock(e.mutex);
+    return e.connections.erase(handle) ? SCARD_S_SUCCESS : SCARD_E_INVALID_HANDLE;
+}
+
+LONG emulatorBeginTransaction(SCARDHANDLE handle)
+{
+    const auto connection = findConnection(handle);
+    if (!connection) {
+        return SCARD_E_INVALID_HANDLE;
+    }
+    auto& card = *connection->card;
+    std::unique_lock<std::mutex> lock(card.mutex);
+    card.transactionEnded.wait(lock, [&card, handle] {
+        return card.removed || !card.transactionOwner || card.transactionOwner == handle;
+    });
+    if (card.removed) {
+        return SCARD_W_REMOVED_CARD;
+    }
+    card.transactionOwner = handle;
+    return SCARD_S_SUCCESS;
+}
+
+LONG emulatorEndTransaction(SCARDHANDLE handle, DWORD /* disposition */)
+{
+    const auto connection = findConnection(handle);
+    if (!connection) {
+        return SCARD_E_INVALID_HANDLE;
+    }
+    auto& card = *connection->card;
+    {
+        std::lock_guard<std::mutex> lock(card.mutex);
+        if (card.transactionOwner == handle) {
+            card.transactionOwner = 0;
+        }
+    }
+    card.transactionEnded.notify_all();
+    return SCARD_S_SUCCESS;
+}
+
+LONG emulatorStatus(SCARDHANDLE handle, string_t::value_type* readerName, LPDWORD readerNameLength,
+                    LPDWORD state, LPDWORD protocol, LPBYTE atr, LPDWORD atrLength)
+{
+    const auto connection = findConnection(handle);
+    if (!connection) {
+        return SCARD_E_INVALID_HANDLE;
+    }
+    if (connection->card->removed) {
+        return SCARD_W_REMOVED_CARD;
+    }
+    const auto& card = connection->card->card;
+    if (state) {
+        *state = SCARD_SPECIFIC;
+    }
+    if (protocol) {
+        *protocol = scardProtocol(card.protocol);
+    }
+    // The reader name length includes the terminating \0.
+    const auto result = copyToBuffer(connection->reader.c_str(), connection->reader.size() + 1,
+                                     readerName, readerNameLength);
+    if (result != SCARD_S_SUCCESS) {
+        return result;
+    }
+    return copyToBuffer(card.atr.data(), card.atr.size(), atr, atrLength);
+}
+
+LONG emulatorTransmit(SCARDHANDLE handle, const SCARD_IO_REQUEST* sendPci, LPCBYTE command,
+                      DWORD commandLength, SCARD_IO_REQUEST* /* receivePci */, LPBYTE response,
+                      LPDWORD responseLength)
+{
+    if (!command || !response || !responseLength) {
+        return SCARD_E_INVALID_VALUE;
+    }
+    const auto connection = findConnection(handle);
+    if (!connection) {
+        return SCARD_E_INVALID_HANDLE;
+    }
+    auto& card = *connection->card;
+    if (sendPci && sendPci->dwProtocol != scardProtocol(card.card.protocol)) {
+        return SCARD_E_INVALID_VALUE;
+    }
+
+    auto responseBytes = apdu_byte_vector {};
+    {
+        std::unique_lock<std::mutex> lock(card.mutex);
+        // Other connections wait while a transaction is in progress.
+        card.transactionEnded.wait(lock, [&card, handle] {
+            return card.removed || !card.transactionOwner || card.transactionOwner == handle;
+        });
+        if (card.removed) {
+            return SCARD_W_REMOVED_CARD;
+        }
+        responseBytes = processCommand(*connection, command, commandLength);
+    }
+
+    const auto delay = transmitTime(card.card, commandLength + responseBytes.size());
+    if (delay.count() > 0) {
+        std::this_thread::sleep_for(delay);
+    }
+    return copyToBuffer(responseBytes.data(), responseBytes.size(), response, responseLength);
+}
+
+LONG emulatorControl(SCARDHANDLE handle, DWORD controlCode, LPCVOID /* inBuffer */,
+                     DWORD /* inBufferSize */, LPVOID /* outBuffer */, DWORD /* outBufferSize */,
+                     LPDWORD bytesReturned)
+{
+    const auto connection = findConnection(handle);
+    if (!connection) {
+        return SCARD_E_INVALID_HANDLE;
+    }
+    if (connection->card->removed) {
+        return SCARD_W_REMOVED_CARD;
+    }
+    if (controlCode != DWORD(CM_IOCTL_GET_FEATURE_REQUEST)) {
+        return SCARD_E_UNSUPPORTED_FEATURE;
+    }
+    // Emulated readers have no PIN pad or other features.
+    if (bytesReturned) {
+        *bytesReturned = 0;
+    }
+    return SCARD_S_SUCCESS;
+}
+
+const PcscBackend EMULATED_PCSC_BACKEND {
+    emulatorEstablishContext,
+    emulatorReleaseContext,
+    emulatorIsValidContext,
+    emulatorListReaders,
+    emulatorGetStatusChange,
+    emulatorCancel,
+    emulatorConnect,
+    emulatorDisconnect,
+    emulatorBeginTransaction,
+    emulatorEndTransaction,
+    emulatorStatus,
+    emulatorTransmit,
+    emulatorControl,
+};
+
+} // namespace
+
+namespace pcsc_cpp
+{
+
+EmulatedFile EmulatedFile::dedicated(const uint16_t id, std::vector<EmulatedFile> children,
+                                     byte_vector dfName)
+{
+    auto file = EmulatedFile {};
+    file.id = id;
+    file.isDedicated = true;
+    file.dfName = std::move(dfName);
+    file.children = std::move(children);
+    return file;
+}
+
+EmulatedFile EmulatedFile::elementary(const uint16_t id, byte_vector content)
+{
+    auto file = EmulatedFile {};
+    file.id = id;
+    file.content = std::move(content);
+    return file;
+}
+
+const PcscBackend& emulatedPcscBackend()
+{
+    return EMULATED_PCSC_BACKEND;
+}
+
+void insertEmulatedCard(const string_t& readerName, EmulatedCard card)
+{
+    if (!card.masterFile.isDedicated) {
+        THROW(std::invalid_argument, "The master file of an emulated card must be a DF");
+    }
+    auto& e = emulator();
+    std::shared_ptr<CardState> previousCard;
+    {
+        std::lock_guard<std::mutex> lock(e.mutex);
+        auto [reader, added] = e.readers.try_emplace(readerName);
+        if (added) {
+            ++e.readerListVersion;
+        }
+        previousCard = std::move(reader->second.card);
+        reader->second.card = std::make_shared<CardState>(std::move(card));
+        reader->second.eventCounter += previousCard ? 2 : 1;
+    }
+    if (previousCard) {
+        markRemoved(previousCard);
+    }
+    e.stateChanged.notify_all();
+}
+
+void removeEmulatedCard(const string_t& readerName)
+{
+    auto& e = emulator();
+    std::shared_ptr<CardState> card;
+    {
+        std::lock_guard<std::mutex> lock(e.mutex);
+        const auto reader = e.readers.find(readerName);
+        if (reader == e.readers.end() || !reader->second.card) {
+            return;
+        }
+        card = std::move(reader->second.card);
+        ++reader->second.eventCounter;
+    }
+    markRemoved(card);
+    e.stateChanged.notify_all();
+}
+
+void removeEmulatedReaders()
+{
+    auto& e = emulator();
+    std::map<string_t, EmulatedReader> readers;
+    {
+        std::lock_guard<std::mutex> lock(e.mutex);
+        std::swap(readers, e.readers);
+        ++e.readerListVersion;
+    }
+    for (const auto& reader : readers) {
+        if (reader.second.card) {
+            markRemoved(reader.second.card);
+        }
+    }
+    e.stateChanged.notify_all();
+}
+
+} // namespace pcsc_cpp
@@ -0,0 +1,318 @@
+/*
+ * Copyright (c) 2020-2023 Estonian Information System Authority
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "pcsc-cpp/pcsc-cpp.hpp"
+#include "pcsc-cpp/pcsc-cpp-utils.hpp"
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include <array>
+#include <cerrno>
+#include <cstring>
+#include <mutex>
+
+using namespace std::string_literals;
+
+namespace pcsc_cpp
+{
+
+#ifndef _WIN32
+
+namespace
+{
+
+constexpr std::array<char, 8> MAGIC {'P', 'C', 'S', 'C', 'P', 'R', 'O', 'F'};
+constexpr size_t MAX_ATR_SIZE = 33;
+// pcsc-lite MAX_READERNAME.
+constexpr size_t MAX_READER_NAME_SIZE = 128;
+constexpr uint32_t ENTRY_CAPACITY = 256;
+
+struct FileHeader
+{
+    std::array<char, 8> magic;
+    uint32_t version;
+    uint32_t entryCapacity;
+    uint32_t entryCount;
+    // Slot that is overwritten next when the cache is full.
+    uint32_t nextEntry;
+};
+
+struct FileEntry
+{
+    uint8_t atrSize;
+    std::array<uint8_t, MAX_ATR_SIZE> atr;
+    uint8_t readerNameSize;
+    std::array<char, MAX_READER_NAME_SIZE> readerName;
+    uint8_t extendedLengthSupported;
+    uint32_t readBinaryBlockLength;
+};
+
+constexpr size_t FILE_SIZE = sizeof(FileHeader) + ENTRY_CAPACITY * sizeof(FileEntry);
+
+std::string errnoString()
+{
+    return std::strerror(errno);
+}
+
+/** Holds a flock() on the cache file, shared for lookups and exclusive for updates. */
+class FileLock
+{
+public:
+    FileLock(const int fd, const int operation) : fd(fd)
+    {
+        while (flock(fd, operation) != 0) {
+            if (errno != EINTR) {
+                THROW(SystemError, "CardProfileCache: flock() failed: " + errnoString());
+            }
+        }
+    }
+
+    ~FileLock() { flock(fd, LOCK_UN); }
+
+    PCSC_CPP_DISABLE_COPY_MOVE(FileLock);
+
+private:
+    const int fd;
+};
+
+bool matches(const FileEntry& entry, const Reader& reader)
+{
+    return entry.atrSize == reader.cardAtr.size() && entry.readerNameSize == reader.name.size()
+        && std::equal(reader.cardAtr.cbegin(), reader.cardAtr.cend(), entry.atr.cbegin())
+        && std::equal(reader.name.cbegin(), reader.name.cend(), entry.readerName.cbegin());
+}
+
+/**
+ * Entries come from a file that other processes write, check them before use. A block length of
+ * 0 means unknown.
+ */
+bool isValid(const FileEntry& entry)
+{
+    return entry.atrSize != 0 && entry.atrSize <= MAX_ATR_SIZE && entry.readerNameSize != 0
+        && entry.readerNameSize <= MAX_READER_NAME_SIZE && entry.extendedLengthSupported <= 1
+        && entry.readBinaryBlockLength <= CommandApdu::MAX_EXTENDED_LE;
+}
+
+bool isCacheable(const Reader& reader)
+{
+    return !reader.cardAtr.empty() && reader.cardAtr.size() <= MAX_ATR_SIZE
+        && !reader.name.empty() && reader.name.size() <= MAX_READER_NAME_SIZE;
+}
+
+} // namespace
+
+class CardProfileCache::Impl
+{
+public:
+    explicit Impl(const std::string& filePath) :
+        fd(open(filePath.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0600))
+    {
+        if (fd < 0) {
+            THROW(SystemError,
+                  "CardProfileCache: cannot open '" + filePath + "': " + errnoString());
+        }
+        try {
+            mapFile();
+        } catch (...) {
+            close(fd);
+            throw;
+        }
+    }
+
+    ~Impl()
+    {
+        munmap(mapping, FILE_SIZE);
+        close(fd);
+    }
+
+    PCSC_CPP_DISABLE_COPY_MOVE(Impl);
+
+    std::optional<CardProfile> find(const Reader& reader) const
+    {
+        if (!isCacheable(reader)) {
+            return {};
+        }
+
+        std::lock_guard<std::mutex> threadLock(mutex);
+        FileLock fileLock(fd, LOCK_SH);
+
+        if (!hasCurrentVersion()) {
+            return {};
+        }
+        for (uint32_t i = 0; i < header()->entryCount; ++i) {
+            const auto& entry = entries()[i];
+            if (isValid(entry) && matches(entry, reader)) {
+                return CardProfile {entry.extendedLengthSupported != 0,
+                                    entry.readBinaryBlockLength};
+            }
+        }
+        return {};
+    }
+
+    void store(const Reader& reader, const CardProfile& profile)
+    {
+        if (!isCacheable(reader)) {
+            return;
+        }
+
+        std::lock_guard<std::mutex> threadLock(mutex);
+        FileLock fileLock(fd, LOCK_EX);
+
+        if (!hasCurrentVersion()) {
+            return;
+        }
+
+        auto* fileHeader = header();
+        auto* entry = std::find_if(entries(), entries() + fileHeader->entryCount,
+                                   [&reader](const auto& e) { return matches(e, reader); });
+        if (entry == entries() + fileHeader->entryCount) {
+            entry = entries() + fileHeader->nextEntry;
+            fileHeader->nextEntry = (fileHeader->nextEntry + 1) % ENTRY_CAPACITY;
+            fileHeader->entryCount = std::min(fileHeader->entryCount + 1, ENTRY_CAPACITY);
+
+            *entry = {};
+            entry->atrSize = uint8_t(reader.cardAtr.size());
+            std::copy(reader.cardAtr.cbegin(), reader.cardAtr.cend(), entry->atr.begin());
+            entry->readerNameSize = uint8_t(reader.name.size());
+            std::copy(reader.name.cbegin(), reader.name.cend(), entry->readerName.begin());
+        }
+        entry->extendedLengthSupported = profile.extendedLengthSupported;
+        entry->readBinaryBlockLength = uint32_t(profile.readBinaryBlockLength);
+    }
+
+private:
+    void mapFile()
+    {
+        FileLock fileLock(fd, LOCK_EX);
+
+        struct stat fileStat {};
+        if (fstat(fd, &fileStat) != 0) {
+            THROW(SystemError, "CardProfileCache: fstat() failed: " + errnoString());
+        }
+        // Never shrink the file, other processes may have mapped a larger file.
+        if (size_t(fileStat.st_size) < FILE_SIZE && ftruncate(fd, off_t(FILE_SIZE)) != 0) {
+            THROW(SystemError, "CardProfileCache: ftruncate() failed: " + errnoString());
+        }
+
+        auto* address = mmap(nullptr, FILE_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (address == MAP_FAILED) {
+            THROW(SystemError, "CardProfileCache: mmap() failed: " + errnoString());
+        }
+        mapping = address;
+
+        // A new file or a file with an older format version is reinitialized.
+        const auto* fileHeader = header();
+        if (fileHeader->magic != MAGIC || fileHeader->version < VERSION
+            || (fileHeader->version == VERSION && fileHeader->entryCapacity != ENTRY_CAPACITY)) {
+            std::memset(mapping, 0, FILE_SIZE);
+            *header() = {MAGIC, VERSION, ENTRY_CAPACITY, 0, 0};
+        } else if (hasCurrentVersion()) {
+            clearInvalidEntries();
+        }
+    }
+
+    /** Clear entries that cannot be applied, the next update() of the card stores a new one. */
+    void clearInvalidEntries()
+    {
+        for (uint32_t i = 0; i < header()->entryCount; ++i) {
+            if (!isValid(entries()[i])) {
+                entries()[i] = {};
+            }
+        }
+    }
+
+    bool hasCurrentVersion() const
+    {
+        return header()->version == VERSION && header()->entryCount <= ENTRY_CAPACITY
+            && header()->nextEntry < ENTRY_CAPACITY;
+    }
+
+    FileHeader* header() const { return static_cast<FileHeader*>(mapping); }
+
+    FileEntry* entries() const
+    {
+        return reinterpret_cast<FileEntry*>(static_cast<char*>(mapping) + sizeof(FileHeader));
+    }
+
+    const int fd;
+    void* mapping = nullptr;
+    mutable std::mutex mutex;
+};
+
+#else
+
+class CardProfileCache::Impl
+{
+public:
+    explicit Impl(const std::string&)
+    {
+        THROW(SystemError, "CardProfileCache is not supported on Windows");
+    }
+
+    std::optional<CardProfile> find(const Reader&) const { return {}; }
+    void store(const Reader&, const CardProfile&) {}
+};
+
+#endif // _WIN32
+
+CardProfileCache::CardProfileCache(const std::string& filePath) :
+    impl(std::make_unique<Impl>(filePath))
+{
+}
+
+CardProfileCache::~CardProfileCache() = default;
+
+std::optional<CardProfile> CardProfileCache::find(const Reader& reader) const
+{
+    return impl->find(reader);
+}
+
+void CardProfileCache::store(const Reader& reader, const CardProfile& profile)
+{
+    impl->store(reader, profile);
+}
+
+bool CardProfileCache::apply(const Reader& reader, SmartCard& card) const
+{
+    const auto profile = find(reader);
+    if (!profile) {
+        return false;
+    }
+    card.setExtendedLengthSupported(profile->extendedLengthSupported);
+    if (profile->readBinaryBlockLength != 0) {
+        setReadBinaryBlockLength(reader.cardAtr, profile->readBinaryBlockLength);
+    }
+    return true;
+}
+
+void CardProfileCache::update(const Reader& reader, const SmartCard& card)
+{
+    store(reader, {card.extendedLengthSupported(), readBinaryBlockLength(card.atr())});
+}
+
+} // namespace pcsc_cpp
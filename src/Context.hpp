@@ -29,38 +29,105 @@
 
 #include "pcsc-cpp/comp_winscard.hpp"
 
+#include <array>
+#include <atomic>
+#include <map>
+#include <mutex>
+#include <optional>
+
 namespace pcsc_cpp
 {
 
+/** Reader feature control codes indexed by DRIVER_FEATURES tag, 0 if the feature is absent. */
+using ReaderFeatures = std::array<uint32_t, FEATURE_CCID_ESC_COMMAND + 1>;
+
 class Context
 {
 public:
-    Context()
+    explicit Context(const PcscBackend& pcscBackend = defaultPcscBackend()) :
+        _backend(pcscBackend)
+    {
+        establish();
+    }
+
+    ~Context() { release(); }
+
+    PCSC_CPP_DISABLE_COPY_MOVE(Context);
+
+    SCARDCONTEXT handle() const { return contextHandle; }
+
+    /** The PC/SC API functions for this context and the cards connected in it. */
+    const PcscBackend& backend() const { return _backend; }
+
+    /** Re-establish the context if SCardIsValidContext() reports that it is no longer valid. */
+    void ensureValid()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (_backend.IsValidContext(contextHandle) != SCARD_S_SUCCESS) {
+            release();
+            establish();
+        }
+    }
+
+    /**
+     * Re-establish the context after the PC/SC service has been restarted. The failed handle is
+     * compared with the current one so that concurrent callers re-establish the context only once.
+     */
+    void reestablish(const SCARDCONTEXT failedHandle)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (contextHandle == failedHandle) {
+            release();
+            establish();
+        }
+    }
+
+    /** Reader features that have been discovered in this context, by reader name. */
+    std::optional<ReaderFeatures> readerFeatures(const string_t& readerName)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        const auto features = readerFeatureCache.find(readerName);
+        if (features == readerFeatureCache.cend()) {
+            return {};
+        }
+        return features->second;
+    }
+
+    void setReaderFeatures(const string_t& readerName, const ReaderFeatures& features)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        readerFeatureCache[readerName] = features;
+    }
+
+private:
+    void establish()
     {
-        SCard(EstablishContext, DWORD(SCARD_SCOPE_USER), nullptr, nullptr, &contextHandle);
-        if (!contextHandle) {
+        SCARDCONTEXT newHandle = 0;
+        SCard(EstablishContext, _backend, DWORD(SCARD_SCOPE_USER), nullptr, nullptr, &newHandle);
+        if (!newHandle) {
             THROW(ScardError,
                   "Context:SCardEstablishContext: service unavailable "
                   "(null context handle)");
         }
+        contextHandle = newHandle;
     }
 
-    ~Context()
+    void release() noexcept
     {
         if (contextHandle) {
             // Cannot throw in destructor, so cannot use the SCard() macro here.
-            auto result = SCardReleaseContext(contextHandle);
+            auto result = _backend.ReleaseContext(contextHandle);
             contextHandle = 0;
             (void)result; // TODO: Log result here in case it is not OK.
         }
+        // Readers may have changed while the service was not available.
+        readerFeatureCache.clear();
     }
 
-    PCSC_CPP_DISABLE_COPY_MOVE(Context);
-
-    SCARDCONTEXT handle() const { return contextHandle; }
-
-private:
-    SCARDCONTEXT contextHandle = 0;
+    const PcscBackend _backend;
+    std::atomic<SCARDCONTEXT> contextHandle {0};
+    std::mutex mutex;
+    std::map<string_t, ReaderFeatures> readerFeatureCache;
 };
 
 } // namespace pcsc_cpp
@@ -0,0 +1,73 @@
+/*
+ * Copyright (c) 2020-2023 Estonian Information System Authority
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "pcsc-cpp/pcsc-backend.hpp"
+
+#include <mutex>
+
+namespace
+{
+
+using namespace pcsc_cpp;
+
+const PcscBackend SYSTEM_PCSC_BACKEND {
+    SCardEstablishContext,
+    SCardReleaseContext,
+    SCardIsValidContext,
+    SCardListReaders,
+    SCardGetStatusChange,
+    SCardCancel,
+    SCardConnect,
+    SCardDisconnect,
+    SCardBeginTransaction,
+    SCardEndTransaction,
+    SCardStatus,
+    SCardTransmit,
+    SCardControl,
+};
+
+std::mutex defaultBackendMutex;
+PcscBackend defaultBackend = SYSTEM_PCSC_BACKEND;
+
+} // namespace
+
+namespace pcsc_cpp
+{
+
+const PcscBackend& systemPcscBackend()
+{
+    return SYSTEM_PCSC_BACKEND;
+}
+
+PcscBackend defaultPcscBackend()
+{
+    std::lock_guard<std::mutex> lock(defaultBackendMutex);
+    return defaultBackend;
+}
+
+void setDefaultPcscBackend(const PcscBackend& backend)
+{
+    std::lock_guard<std::mutex> lock(defaultBackendMutex);
+    defaultBackend = backend;
+}
+
+} // namespace pcsc_cpp
@@ -0,0 +1,237 @@
+/*
+ * Copyright (c) 2020-2023 Estonian Information System Authority
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "pcsc-cpp/pcsc-cpp.hpp"
+
+#include "ReaderStates.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <thread>
+
+namespace
+{
+
+using namespace pcsc_cpp;
+
+#ifdef _WIN32
+const string_t PNP_NOTIFICATION = L"\\\\?PnP?\\Notification";
+#else
+const string_t PNP_NOTIFICATION = "\\\\?PnP?\\Notification";
+#endif
+
+} // anonymous namespace
+
+namespace pcsc_cpp
+{
+
+class ReaderMonitor::Impl
+{
+public:
+    Impl(EventCallback eventCallback, ErrorCallback errorCallback) :
+        onEvent(std::move(eventCallback)), onError(std::move(errorCallback)),
+        readerContext(std::make_shared<Context>(monitorContext.backend())),
+        thread([this] { run(); })
+    {
+    }
+
+    ~Impl()
+    {
+        stopRequested = true;
+        // SCardCancel() only interrupts a pending SCardGetStatusChange() call, so repeat it
+        // until the monitor thread has noticed the stop request.
+        while (running) {
+            // Cannot throw in destructor, so cannot use the SCard() macro here.
+            auto result = monitorContext.backend().Cancel(monitorContext.handle());
+            (void)result;
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+        thread.join();
+    }
+
+    PCSC_CPP_DISABLE_COPY_MOVE(Impl);
+
+private:
+    void run() noexcept
+    {
+        try {
+            monitor();
+        } catch (const std::exception& error) {
+            if (!stopRequested && onError) {
+                try {
+                    onError(error);
+                } catch (...) {
+                    // Ignore exceptions from the callback, the thread is ending anyway.
+                }
+            }
+        }
+        running = false;
+    }
+
+    void monitor()
+    {
+        updateReaders();
+
+        while (!stopRequested) {
+            try {
+                SCard(GetStatusChange, monitorContext.backend(), monitorContext.handle(),
+                      DWORD(INFINITE), readerStates.data(), DWORD(readerStates.size()));
+            } catch (const ScardError&) {
+                // SCardCancel() from the destructor ends the wait with an error.
+                if (stopRequested) {
+                    return;
+                }
+                throw;
+            }
+
+            // The upper 16 bits of the PnP state are an event counter in pcsc-lite but the reader
+            // count on Windows, which does not change when a reader is replaced.
+            auto& pnpState = readerStates.front();
+            if (pnpState.dwEventState & SCARD_STATE_CHANGED) {
+                pnpState.dwCurrentState = pnpState.dwEventState & ~DWORD(SCARD_STATE_CHANGED);
+                updateReaders();
+            }
+
+            reportChanges();
+        }
+    }
+
+    /** Refresh reader names after a plug-and-play event and report detached readers. */
+    void updateReaders()
+    {
+        auto newReaderNames = ReaderNameBuffer {};
+        try {
+            newReaderNames = populateReaderNames<ReaderNameBuffer>(monitorContext);
+        } catch (const ScardNoReadersError& /* e */) {
+            // All readers have been detached.
+        }
+
+        if (readerStates.empty()) {
+            readerStates.push_back(makeUnawareReaderState(PNP_NOTIFICATION.c_str()));
+        }
+
+        auto newReaderStates = std::vector<SCARD_READERSTATE> {readerStates.front()};
+        auto keptStates = std::vector<bool>(readerStates.size(), false);
+
+        for (const auto* readerName : getReaderNamePointerList(newReaderNames)) {
+            auto existing = std::find_if(std::next(readerStates.cbegin()), readerStates.cend(),
+                                         [readerName](const SCARD_READERSTATE& state) {
+                                             return string_t(state.szReader) == readerName;
+                                         });
+            if (existing != readerStates.cend()) {
+                keptStates[size_t(std::distance(readerStates.cbegin(), existing))] = true;
+                newReaderStates.push_back(*existing);
+                newReaderStates.back().szReader = readerName;
+            } else {
+                newReaderStates.push_back(makeUnawareReaderState(readerName));
+            }
+        }
+
+        for (size_t i = 1; i < readerStates.size(); ++i) {
+            if (!keptStates[i] && readerStates[i].dwCurrentState != SCARD_STATE_UNAWARE) {
+                notify(Event::READER_DETACHED, readerStates[i]);
+            }
+        }
+
+        // Reader states point into the name buffer, replace them together. Moving the vector
+        // keeps its storage, so the pointers of the new states remain valid.
+        readerNames = std::move(newReaderNames);
+        readerStates = std::move(newReaderStates);
+    }
+
+    void reportChanges()
+    {
+        for (auto state = std::next(readerStates.begin()); state != readerStates.end(); ++state) {
+            const auto previous = state->dwCurrentState;
+            const auto current = state->dwEventState & ~DWORD(SCARD_STATE_CHANGED);
+
+            // Readers added by the last plug-and-play event have not been queried yet.
+            if (current == SCARD_STATE_UNAWARE) {
+                continue;
+            }
+            if (previous != SCARD_STATE_UNAWARE && !readerStateChanged(previous, current)) {
+                continue;
+            }
+            state->dwCurrentState = current;
+
+            if (current & (SCARD_STATE_UNKNOWN | SCARD_STATE_IGNORE)) {
+                // The reader is going away, the plug-and-play event reports it as detached.
+                continue;
+            }
+
+            const bool wasPresent = previous & SCARD_STATE_PRESENT;
+            const bool isPresent = current & SCARD_STATE_PRESENT;
+            // A changed counter while the card stays present means that the card was swapped.
+            const bool swapped = wasPresent && isPresent
+                && eventCounter(previous) != eventCounter(current);
+
+            if (previous == SCARD_STATE_UNAWARE) {
+                notify(Event::READER_ATTACHED, *state);
+            }
+            if ((wasPresent && !isPresent) || swapped) {
+                notify(Event::CARD_REMOVED, *state);
+            }
+            if ((isPresent && !wasPresent) || swapped) {
+                notify(Event::CARD_INSERTED, *state);
+            }
+        }
+    }
+
+    void notify(const Event event, const SCARD_READERSTATE& readerState)
+    {
+        if (event == Event::CARD_REMOVED || event == Event::READER_DETACHED) {
+            // The card is gone, do not report the previous card ATR or presence.
+            onEvent(event,
+                    Reader {readerContext, readerState.szReader, byte_vector {},
+                            flagSetFromReaderState(readerState.dwCurrentState
+                                                   & ~DWORD(SCARD_STATE_PRESENT))});
+        } else {
+            onEvent(event, makeReader(readerContext, readerState));
+        }
+    }
+
+    EventCallback onEvent;
+    ErrorCallback onError;
+
+    // The monitor thread blocks in its own context, readers passed to callbacks use another one
+    // so that they can connect to cards from other threads.
+    Context monitorContext;
+    ContextPtr readerContext;
+
+    ReaderNameBuffer readerNames;
+    std::vector<SCARD_READERSTATE> readerStates;
+
+    std::atomic<bool> stopRequested {false};
+    std::atomic<bool> running {true};
+    // Must be last, the thread starts running in the constructor.
+    std::thread thread;
+};
+
+ReaderMonitor::ReaderMonitor(EventCallback onEvent, ErrorCallback onError) :
+    impl(std::make_unique<Impl>(std::move(onEvent), std::move(onError)))
+{
+}
+
+ReaderMonitor::~ReaderMonitor() = default;
+
+} // namespace pcsc_cpp
@@ -0,0 +1,201 @@
+/*
+ * Copyright (c) 2020-2023 Estonian Information System Authority
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "pcsc-cpp/pcsc-cpp.hpp"
+
+#include "ReaderStates.hpp"
+
+#include <algorithm>
+
+namespace pcsc_cpp
+{
+
+class ReaderSnapshot::Impl
+{
+public:
+    explicit Impl(ContextPtr context) : ctx(std::move(context)) { REQUIRE_NON_NULL(ctx) }
+
+    Diff refresh()
+    {
+        ctx->ensureValid();
+
+        auto diff = Diff {};
+
+        if (updateReaderNames()) {
+            rebuildReaderStates(diff);
+        }
+
+        queryReaderStates();
+
+        for (auto& state : readerStates) {
+            const auto previous = state.dwCurrentState;
+            const auto current = state.dwEventState & ~DWORD(SCARD_STATE_CHANGED);
+
+            if (previous == SCARD_STATE_UNAWARE) {
+                diff.added.emplace_back(makeReader(ctx, state));
+            } else if (readerStateChanged(previous, current)) {
+                diff.changed.emplace_back(makeReader(ctx, state));
+            }
+            state.dwCurrentState = current;
+        }
+
+        return diff;
+    }
+
+    std::vector<Reader> readers() const
+    {
+        auto result = std::vector<Reader> {};
+        result.reserve(readerStates.size());
+        for (const auto& state : readerStates) {
+            result.emplace_back(makeReader(ctx, state));
+        }
+        return result;
+    }
+
+private:
+    /**
+     * Read reader names into the spare buffer with a single SCardListReaders() call when the
+     * buffer is large enough. Returns true and swaps the buffers if the names have changed.
+     */
+    bool updateReaderNames()
+    {
+        auto length = DWORD(spareReaderNames.size());
+        auto result = spareReaderNames.empty() ? LONG(SCARD_E_INSUFFICIENT_BUFFER)
+                                               : listReaderNames(spareReaderNames.data(), length);
+
+        if (result == LONG(SCARD_E_INSUFFICIENT_BUFFER)) {
+            length = 0;
+            result = listReaderNames(nullptr, length);
+            if (result == SCARD_S_SUCCESS) {
+                spareReaderNames.resize(length);
+                result = listReaderNames(spareReaderNames.data(), length);
+            }
+        }
+
+        switch (result) {
+        case SCARD_S_SUCCESS:
+            break;
+        case LONG(SCARD_E_NO_READERS_AVAILABLE):
+            // No readers is an empty reader list, as in listReaders().
+            length = 0;
+            if (!spareReaderNames.empty()) {
+                spareReaderNames[0] = 0;
+            }
+            break;
+        default:
+            checkSCardResult(__FUNCTION__, __FILE__, __LINE__, "SCardListReaders", result);
+        }
+
+        if (length == readerNamesLength
+            && std::equal(spareReaderNames.cbegin(), spareReaderNames.cbegin() + length,
+                          readerNames.cbegin())) {
+            return false;
+        }
+
+        // Buffers are swapped instead of copied. The vectors exchange their heap storage, so the
+        // current reader states keep pointing to the old names until they are rebuilt.
+        std::swap(readerNames, spareReaderNames);
+        readerNamesLength = length;
+        return true;
+    }
+
+    LONG listReaderNames(string_t::value_type* buffer, DWORD& length) const
+    {
+        return SCardResult(ListReaders, ctx->backend(), ctx->handle(), nullptr, buffer, &length);
+    }
+
+    /** Keep the states of readers that are still attached and report the removed readers. */
+    void rebuildReaderStates(Diff& diff)
+    {
+        auto newReaderStates = std::vector<SCARD_READERSTATE> {};
+        auto kept = std::vector<bool>(readerStates.size(), false);
+
+        const auto readerNamePointers = readerNamesLength
+            ? getReaderNamePointerList(readerNames)
+            : std::vector<const string_t::value_type*> {};
+
+        newReaderStates.reserve(readerNamePointers.size());
+        for (const auto* readerName : readerNamePointers) {
+            auto existing = std::find_if(readerStates.cbegin(), readerStates.cend(),
+                                         [readerName](const SCARD_READERSTATE& state) {
+                                             return string_t(state.szReader) == readerName;
+                                         });
+            if (existing != readerStates.cend()) {
+                kept[size_t(std::distance(readerStates.cbegin(), existing))] = true;
+                newReaderStates.push_back(*existing);
+                newReaderStates.back().szReader = readerName;
+            } else {
+                newReaderStates.push_back(makeUnawareReaderState(readerName));
+            }
+        }
+
+        for (size_t i = 0; i < readerStates.size(); ++i) {
+            if (!kept[i]) {
+                diff.removed.emplace_back(makeReader(ctx, readerStates[i]));
+            }
+        }
+
+        readerStates = std::move(newReaderStates);
+    }
+
+    void queryReaderStates()
+    {
+        if (readerStates.empty()) {
+            return;
+        }
+
+        const auto result = SCardResult(GetStatusChange, ctx->backend(), ctx->handle(), 0U,
+                                        readerStates.data(), DWORD(readerStates.size()));
+        if (result == LONG(SCARD_E_TIMEOUT)) {
+            // Nothing has changed since the previous refresh.
+            for (auto& state : readerStates) {
+                state.dwEventState = state.dwCurrentState;
+            }
+            return;
+        }
+        checkSCardResult(__FUNCTION__, __FILE__, __LINE__, "SCardGetStatusChange", result);
+    }
+
+    ContextPtr ctx;
+
+    ReaderNameBuffer readerNames;
+    ReaderNameBuffer spareReaderNames;
+    DWORD readerNamesLength = 0;
+
+    std::vector<SCARD_READERSTATE> readerStates;
+};
+
+ReaderSnapshot::ReaderSnapshot(ContextPtr ctx) : impl(std::make_unique<Impl>(std::move(ctx))) {}
+
+ReaderSnapshot::~ReaderSnapshot() = default;
+
+ReaderSnapshot::Diff ReaderSnapshot::refresh()
+{
+    return impl->refresh();
+}
+
+std::vector<Reader> ReaderSnapshot::readers() const
+{
+    return impl->readers();
+}
+
+} // namespace pcsc_cpp
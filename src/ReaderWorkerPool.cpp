@@ -0,0 +1,314 @@
+/*
+ * Copyright (c) 2020-2023 Estonian Information System Authority
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "pcsc-cpp/pcsc-cpp.hpp"
+
+#include "ReaderStates.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <optional>
+#include <thread>
+
+namespace pcsc_cpp
+{
+
+class ReaderWorkerPool::Impl
+{
+public:
+    explicit Impl(const std::vector<string_t>& readerNames) : runningWorkers(readerNames.size())
+    {
+        workers.reserve(readerNames.size());
+        for (const auto& readerName : readerNames) {
+            workers.push_back(std::make_unique<Worker>(*this, readerName));
+        }
+        for (auto& worker : workers) {
+            worker->start();
+        }
+    }
+
+    ~Impl()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        jobAvailable.notify_all();
+        workers.clear();
+    }
+
+    PCSC_CPP_DISABLE_COPY_MOVE(Impl);
+
+    void enqueue(Job job, JobFailure fail)
+    {
+        std::exception_ptr error;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (runningWorkers > 0) {
+                jobs.push_back({std::move(job), std::move(fail)});
+            } else {
+                error = workersStoppedError();
+            }
+        }
+        if (error) {
+            fail(error);
+            return;
+        }
+        jobAvailable.notify_one();
+    }
+
+    size_t pendingJobCount() const
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        return jobs.size();
+    }
+
+private:
+    struct PendingJob
+    {
+        Job run;
+        JobFailure fail;
+    };
+
+    /** Worker owns the PC/SC context, the card connection and the thread of a single reader. */
+    class Worker
+    {
+    public:
+        Worker(Impl& p, string_t name) :
+            pool(p), readerName(std::move(name)), ctx(std::make_shared<Context>())
+        {
+        }
+
+        ~Worker()
+        {
+            // SCardCancel() only interrupts a pending SCardGetStatusChange() call, so repeat it
+            // until the worker thread has noticed that the pool is stopping.
+            while (running) {
+                // Cannot throw in destructor, so cannot use the SCard() macro here.
+                auto result = ctx->backend().Cancel(ctx->handle());
+                (void)result;
+                std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            }
+            if (thread.joinable()) {
+                thread.join();
+            }
+        }
+
+        PCSC_CPP_DISABLE_COPY_MOVE(Worker);
+
+        void start()
+        {
+            running = true;
+            thread = std::thread([this] { run(); });
+        }
+
+    private:
+        void run() noexcept
+        {
+            std::exception_ptr error;
+            while (!pool.isStopping()) {
+                if (!card) {
+                    if (!waitForCard(error)) {
+                        break;
+                    }
+                    continue;
+                }
+
+                auto job = pool.takeJob();
+                if (!job) {
+                    break;
+                }
+                runJob(*job);
+            }
+            card.reset();
+            if (error) {
+                pool.workerStopped(error);
+            }
+            running = false;
+        }
+
+        /**
+         * Block until the reader state changes and connect if a card is present. Returns false
+         * with the error when the reader has gone away or the service has stopped.
+         */
+        bool waitForCard(std::exception_ptr& error)
+        {
+            const SCardCallReaderScope readerScope(readerName);
+            const auto result = SCardResult(GetStatusChange, ctx->backend(), ctx->handle(),
+                                            DWORD(INFINITE), &readerState, 1U);
+            switch (result) {
+            case SCARD_S_SUCCESS:
+                break;
+            case LONG(SCARD_E_TIMEOUT):
+            case LONG(SCARD_E_CANCELLED):
+                return true;
+            default:
+                try {
+                    checkSCardResult(__FUNCTION__, __FILE__, __LINE__, "SCardGetStatusChange",
+                                     result);
+                } catch (...) {
+                    error = std::current_exception();
+                }
+                return false;
+            }
+
+            readerState.dwCurrentState = readerState.dwEventState & ~DWORD(SCARD_STATE_CHANGED);
+            if (!(readerState.dwEventState & SCARD_STATE_PRESENT)
+                || (readerState.dwEventState & SCARD_STATE_MUTE)) {
+                return true;
+            }
+
+            try {
+                card = std::make_unique<SmartCard>(
+                    ctx, readerName,
+                    byte_vector {readerState.rgbAtr, readerState.rgbAtr + readerState.cbAtr});
+            } catch (const ScardError& /* e */) {
+                // The card is not usable, wait for the next state change.
+            }
+            return true;
+        }
+
+        void runJob(PendingJob& job)
+        {
+            try {
+                auto transactionGuard = card->beginTransaction();
+                try {
+                    job.run(*card);
+                } catch (const ScardError& /* e */) {
+                    // The job has received the error through its future, reconnect before the
+                    // next job as the card may have been removed or reset.
+                    reconnect();
+                } catch (...) {
+                    // The job has received the error through its future.
+                }
+            } catch (const ScardError& /* e */) {
+                // The card is not available, let another reader run the job.
+                reconnect();
+                pool.requeue(std::move(job));
+            }
+        }
+
+        /**
+         * Drop the card and query the reader state without waiting for a change, so that a card
+         * that is still present, for example after reset, is connected again right away.
+         */
+        void reconnect()
+        {
+            card.reset();
+            readerState.dwCurrentState = SCARD_STATE_UNAWARE;
+            // Do not spin when the card keeps failing.
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+
+        Impl& pool;
+        const string_t readerName;
+        ContextPtr ctx;
+        SCARD_READERSTATE readerState = makeUnawareReaderState(readerName.c_str());
+        SmartCard::ptr card;
+        std::atomic<bool> running {false};
+        std::thread thread;
+    };
+
+    bool isStopping() const
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        return stopping;
+    }
+
+    /** Wait for the next job, returns no job when the pool is stopping. */
+    std::optional<PendingJob> takeJob()
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        jobAvailable.wait(lock, [this] { return stopping || !jobs.empty(); });
+        if (stopping) {
+            return {};
+        }
+        auto job = std::move(jobs.front());
+        jobs.pop_front();
+        return job;
+    }
+
+    void requeue(PendingJob job)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            jobs.push_front(std::move(job));
+        }
+        jobAvailable.notify_one();
+    }
+
+    /** Fail the pending jobs when the last worker has stopped, nobody else would run them. */
+    void workerStopped(std::exception_ptr error)
+    {
+        auto failedJobs = std::deque<PendingJob> {};
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            lastWorkerError = error;
+            if (--runningWorkers > 0) {
+                return;
+            }
+            failedJobs.swap(jobs);
+        }
+        for (auto& job : failedJobs) {
+            job.fail(error);
+        }
+    }
+
+    std::exception_ptr workersStoppedError() const
+    {
+        return lastWorkerError
+            ? lastWorkerError
+            : std::make_exception_ptr(Error("ReaderWorkerPool: the pool has no readers"));
+    }
+
+    mutable std::mutex mutex;
+    std::condition_variable jobAvailable;
+    std::deque<PendingJob> jobs;
+    size_t runningWorkers;
+    std::exception_ptr lastWorkerError;
+    bool stopping = false;
+
+    // Must be last, workers use the queue until they are destroyed.
+    std::vector<std::unique_ptr<Worker>> workers;
+};
+
+ReaderWorkerPool::ReaderWorkerPool(const std::vector<string_t>& readerNames) :
+    impl(std::make_unique<Impl>(readerNames))
+{
+}
+
+ReaderWorkerPool::~ReaderWorkerPool() = default;
+
+void ReaderWorkerPool::enqueue(Job job, JobFailure fail)
+{
+    impl->enqueue(std::move(job), std::move(fail));
+}
+
+size_t ReaderWorkerPool::pendingJobCount() const
+{
+    return impl->pendingJobCount();
+}
+
+} // namespace pcsc_cpp
@@ -0,0 +1,117 @@
+/*
+ * Copyright (c) 2020-2023 Estonian Information System Authority
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "pcsc-cpp/pcsc-cpp.hpp"
+
+#include <map>
+#include <mutex>
+
+namespace
+{
+
+using namespace pcsc_cpp;
+
+// Caching is opt-in, only the caller knows which files are read-only.
+bool cachesNothing(const CommandApdu&)
+{
+    return false;
+}
+
+} // namespace
+
+namespace pcsc_cpp
+{
+
+class ResponseCache::Impl
+{
+public:
+    explicit Impl(IdempotentPredicate predicate) :
+        isIdempotent(predicate ? std::move(predicate) : cachesNothing)
+    {
+    }
+
+    const IdempotentPredicate isIdempotent;
+
+    using CardIdentity = std::pair<byte_vector, std::string>;
+
+    mutable std::mutex mutex;
+    std::map<CardIdentity, std::map<byte_vector, ResponseApdu>> responses;
+};
+
+ResponseCache::ResponseCache(IdempotentPredicate isIdempotent) :
+    impl(std::make_unique<Impl>(std::move(isIdempotent)))
+{
+}
+
+ResponseCache::~ResponseCache() = default;
+
+bool ResponseCache::isIdempotent(const CommandApdu& command) const
+{
+    return impl->isIdempotent(command);
+}
+
+std::optional<ResponseApdu> ResponseCache::find(const byte_vector& atr,
+                                                const std::string& cardSerial,
+                                                const byte_vector& key) const
+{
+    std::lock_guard<std::mutex> lock(impl->mutex);
+    const auto card = impl->responses.find({atr, cardSerial});
+    if (card == impl->responses.cend()) {
+        return {};
+    }
+    const auto response = card->second.find(key);
+    if (response == card->second.cend()) {
+        return {};
+    }
+    return response->second;
+}
+
+void ResponseCache::store(const byte_vector& atr, const std::string& cardSerial,
+                          const byte_vector& key, const ResponseApdu& response)
+{
+    std::lock_guard<std::mutex> lock(impl->mutex);
+    impl->responses[{atr, cardSerial}].insert_or_assign(key, response);
+}
+
+void ResponseCache::invalidate(const byte_vector& atr, const std::string& cardSerial)
+{
+    std::lock_guard<std::mutex> lock(impl->mutex);
+    impl->responses.erase({atr, cardSerial});
+}
+
+void ResponseCache::invalidate()
+{
+    std::lock_guard<std::mutex> lock(impl->mutex);
+    impl->responses.clear();
+}
+
+size_t ResponseCache::size() const
+{
+    std::lock_guard<std::mutex> lock(impl->mutex);
+    size_t count = 0;
+    for (const auto& card : impl->responses) {
+        count += card.second.size();
+    }
+    return count;
+}
+
+} // namespace pcsc_cpp
@@ -23,9 +23,11 @@
 #pragma once
 
 #include "pcsc-cpp/pcsc-cpp.hpp"
+#include "pcsc-cpp/pcsc-backend.hpp"
 #include "pcsc-cpp/comp_winscard.hpp"
 #include "pcsc-cpp/pcsc-cpp-utils.hpp"
 
+#include <chrono>
 #include <string>
 
 #ifdef _WIN32
@@ -42,14 +44,10 @@ inline std::string buildErrorMessage(const char* callerFunctionName, const char*
         + removeAbsolutePathPrefix(file) + ':' + std::to_string(line) + ':' + callerFunctionName;
 }
 
-template <typename Func, typename... Args>
-void SCardCall(const char* callerFunctionName, const char* file, int line,
-               const char* scardFunctionName, Func scardFunction, Args... args)
+/** Throw the exception that corresponds to the SCard API function result unless it is success. */
+inline void checkSCardResult(const char* callerFunctionName, const char* file, int line,
+                             const char* scardFunctionName, const LONG result)
 {
-    // TODO: Add logging - or is exception error message enough?
-
-    const LONG result = scardFunction(args...);
-
     // TODO: Add more cases when needed.
     switch (result) {
     case SCARD_S_SUCCESS:
@@ -89,8 +87,73 @@ void SCardCall(const char* callerFunctionName, const char* file, int line,
     }
 }
 
+/** Record the result and latency of a PC/SC call for scardCallMetrics(). */
+void recordSCardCall(const char* scardFunctionName, const LONG result,
+                     std::chrono::steady_clock::duration latency);
+
+/**
+ * Attributes the PC/SC calls of the current thread to the reader while in scope. The reader name
+ * must outlive the scope.
+ */
+class SCardCallReaderScope
+{
+public:
+#ifdef PCSC_CPP_METRICS
+    explicit SCardCallReaderScope(const string_t& readerName) : previous(currentReader)
+    {
+        currentReader = &readerName;
+    }
+    ~SCardCallReaderScope() { currentReader = previous; }
+
+    static const string_t* reader() { return currentReader; }
+#else
+    explicit SCardCallReaderScope(const string_t& /* readerName */) {}
+#endif
+    PCSC_CPP_DISABLE_COPY_MOVE(SCardCallReaderScope);
+
+#ifdef PCSC_CPP_METRICS
+private:
+    const string_t* previous;
+    static thread_local const string_t* currentReader;
+#endif
+};
+
+/**
+ * Call the PC/SC API function and record it for scardCallMetrics(), but return the result instead
+ * of throwing, for callers that handle result codes like SCARD_E_TIMEOUT themselves.
+ */
+template <typename Func, typename... Args>
+LONG SCardCallResult(const char* scardFunctionName, Func scardFunction, Args... args)
+{
+#ifdef PCSC_CPP_METRICS
+    const auto start = std::chrono::steady_clock::now();
+    const LONG result = scardFunction(args...);
+    recordSCardCall(scardFunctionName, result, std::chrono::steady_clock::now() - start);
+    return result;
+#else
+    (void)scardFunctionName;
+    return scardFunction(args...);
+#endif
+}
+
+template <typename Func, typename... Args>
+void SCardCall(const char* callerFunctionName, const char* file, int line,
+               const char* scardFunctionName, Func scardFunction, Args... args)
+{
+    // TODO: Add logging - or is exception error message enough?
+
+    const LONG result = SCardCallResult(scardFunctionName, scardFunction, args...);
+
+    checkSCardResult(callerFunctionName, file, line, scardFunctionName, result);
+}
+
 } // namespace pcsc_cpp
 
-#define SCard(APIFunctionName, ...)                                                                \
-    SCardCall(__FUNCTION__, __FILE__, __LINE__, "SCard" #APIFunctionName, SCard##APIFunctionName,  \
-              __VA_ARGS__)
+/** Call the PC/SC API function of the backend and throw on error, see checkSCardResult(). */
+#define SCard(APIFunctionName, backend, ...)                                                       \
+    SCardCall(__FUNCTION__, __FILE__, __LINE__, "SCard" #APIFunctionName,                          \
+              (backend).APIFunctionName, __VA_ARGS__)
+
+/** Call the PC/SC API function of the backend and return the result, see SCardCallResult(). */
+#define SCardResult(APIFunctionName, backend, ...)                                                 \
+    SCardCallResult("SCard" #APIFunctionName, (backend).APIFunctionName, __VA_ARGS__)
@@ -0,0 +1,253 @@
+/*
+ * Copyright (c) 2020-2023 Estonian Information System Authority
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "SCardCall.hpp"
+
+#include <array>
+#include <atomic>
+#include <cmath>
+#include <mutex>
+
+namespace pcsc_cpp
+{
+
+size_t SCardCallMetrics::bucketIndex(const uint64_t latencyMicros)
+{
+    if (latencyMicros < 4) {
+        return size_t(latencyMicros);
+    }
+    // Four linear sub-buckets per power of two, selected by the two bits after the highest bit.
+    size_t highestBit = 2;
+    while (highestBit < 63 && (latencyMicros >> (highestBit + 1)) != 0) {
+        ++highestBit;
+    }
+    const auto bucket = 4 + (highestBit - 2) * 4 + size_t((latencyMicros >> (highestBit - 2)) & 3);
+    return std::min(bucket, HISTOGRAM_BUCKET_COUNT - 1);
+}
+
+uint64_t SCardCallMetrics::bucketLowerBoundMicros(const size_t bucket)
+{
+    if (bucket < 4) {
+        return bucket;
+    }
+    const auto highestBit = (bucket - 4) / 4 + 2;
+    return uint64_t(4 + (bucket - 4) % 4) << (highestBit - 2);
+}
+
+uint64_t SCardCallMetrics::percentileMicros(const double percentile) const
+{
+    uint64_t total = 0;
+    for (const auto count : latencyHistogram) {
+        total += count;
+    }
+    if (total == 0) {
+        return 0;
+    }
+    const auto rank = uint64_t(std::ceil(total * std::min(std::max(percentile, 0.0), 100.0) / 100));
+    uint64_t seen = 0;
+    for (size_t bucket = 0; bucket < latencyHistogram.size(); ++bucket) {
+        seen += latencyHistogram[bucket];
+        if (seen >= rank && seen > 0) {
+            return bucketLowerBoundMicros(bucket);
+        }
+    }
+    return bucketLowerBoundMicros(latencyHistogram.size() - 1);
+}
+
+#ifdef PCSC_CPP_METRICS
+
+thread_local const string_t* SCardCallReaderScope::currentReader = nullptr;
+
+namespace
+{
+
+struct CallStats
+{
+    std::atomic<uint64_t> callCount {};
+    std::atomic<uint64_t> totalLatencyMicros {};
+    std::array<std::atomic<uint64_t>, SCardCallMetrics::HISTOGRAM_BUCKET_COUNT> histogram {};
+    // Guarded by the registry mutex, errors are rare.
+    std::map<uint32_t, uint64_t> errorCounts;
+};
+
+/**
+ * Statistics by function name and reader. Entries are created once and never removed, reset()
+ * only clears them, so the counters can be updated without holding the mutex and threads can
+ * cache the entries.
+ */
+class Registry
+{
+public:
+    CallStats& stats(const char* function, const string_t& reader)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto functionEntry = functions.find(function);
+        if (functionEntry == functions.end()) {
+            functionEntry = functions.emplace(function, ReaderStats {}).first;
+        }
+        auto& readers = functionEntry->second;
+        auto entry = readers.find(reader);
+        if (entry == readers.end()) {
+            entry = readers.emplace(reader, std::make_unique<CallStats>()).first;
+        }
+        return *entry->second;
+    }
+
+    void recordError(CallStats& stats, const LONG result)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        ++stats.errorCounts[uint32_t(result)];
+    }
+
+    std::vector<SCardCallMetrics> snapshot()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        std::vector<SCardCallMetrics> result;
+        for (const auto& function : functions) {
+            for (const auto& reader : function.second) {
+                const auto& stats = *reader.second;
+                SCardCallMetrics metrics;
+                metrics.function = function.first;
+                metrics.reader = reader.first;
+                metrics.callCount = stats.callCount.load(std::memory_order_relaxed);
+                metrics.totalLatencyMicros =
+                    stats.totalLatencyMicros.load(std::memory_order_relaxed);
+                metrics.errorCounts = stats.errorCounts;
+                metrics.latencyHistogram.reserve(stats.histogram.size());
+                for (const auto& bucket : stats.histogram) {
+                    metrics.latencyHistogram.push_back(bucket.load(std::memory_order_relaxed));
+                }
+                result.push_back(std::move(metrics));
+            }
+        }
+        return result;
+    }
+
+    void reset()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (auto& function : functions) {
+            for (auto& reader : function.second) {
+                auto& stats = *reader.second;
+                stats.callCount = 0;
+                stats.totalLatencyMicros = 0;
+                for (auto& bucket : stats.histogram) {
+                    bucket = 0;
+                }
+                stats.errorCounts.clear();
+            }
+        }
+    }
+
+private:
+    using ReaderStats = std::map<string_t, std::unique_ptr<CallStats>, std::less<>>;
+
+    std::mutex mutex;
+    // Transparent comparison avoids a string copy on lookup.
+    std::map<std::string, ReaderStats, std::less<>> functions;
+};
+
+Registry& registry()
+{
+    static Registry instance;
+    return instance;
+}
+
+const string_t NO_READER;
+
+/**
+ * Statistics that the current thread has used, so that the hot path does not lock the registry.
+ * Function names are string literals, so they are compared by address. Reader names are compared
+ * by value as the name of a disconnected card may be freed and its address reused.
+ */
+class ThreadStatsCache
+{
+public:
+    CallStats& stats(const char* function, const string_t& reader)
+    {
+        for (const auto& entry : entries) {
+            if (entry.function == function && entry.reader == reader) {
+                return *entry.stats;
+            }
+        }
+        auto& stats = registry().stats(function, reader);
+        entries.push_back({function, reader, &stats});
+        return stats;
+    }
+
+private:
+    struct Entry
+    {
+        const char* function;
+        string_t reader;
+        CallStats* stats;
+    };
+
+    std::vector<Entry> entries;
+};
+
+} // namespace
+
+void recordSCardCall(const char* scardFunctionName, const LONG result,
+                     const std::chrono::steady_clock::duration latency)
+{
+    thread_local ThreadStatsCache cache;
+
+    const auto* reader = SCardCallReaderScope::reader();
+    auto& stats = cache.stats(scardFunctionName, reader ? *reader : NO_READER);
+
+    const auto micros =
+        uint64_t(std::chrono::duration_cast<std::chrono::microseconds>(latency).count());
+    stats.callCount.fetch_add(1, std::memory_order_relaxed);
+    stats.totalLatencyMicros.fetch_add(micros, std::memory_order_relaxed);
+    stats.histogram[SCardCallMetrics::bucketIndex(micros)].fetch_add(1,
+                                                                      std::memory_order_relaxed);
+
+    if (result != SCARD_S_SUCCESS) {
+        registry().recordError(stats, result);
+    }
+}
+
+std::vector<SCardCallMetrics> scardCallMetrics()
+{
+    return registry().snapshot();
+}
+
+void resetSCardCallMetrics()
+{
+    registry().reset();
+}
+
+#else
+
+void recordSCardCall(const char*, const LONG, std::chrono::steady_clock::duration) {}
+
+std::vector<SCardCallMetrics> scardCallMetrics()
+{
+    return {};
+}
+
+void resetSCardCallMetrics() {}
+
+#endif // PCSC_CPP_METRICS
+
+} // namespace pcsc_cpp
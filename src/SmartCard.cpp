@@ -22,6 +22,8 @@
 
 #include "pcsc-cpp/pcsc-cpp.hpp"
 
+#include "ApduSession.hpp"
+#include "ApduTrace.hpp"
 #include "Context.hpp"
 #include "pcsc-cpp/comp_winscard.hpp"
 
@@ -31,8 +33,13 @@
 #include <arpa/inet.h>
 #endif
 
+#include <algorithm>
 #include <array>
-#include <map>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <optional>
+#include <thread>
 #include <utility>
 
 // TODO: Someday, maybe SCARD_SHARE_SHARED vs SCARD_SHARE_EXCLUSIVE and SCARD_RESET_CARD on
@@ -57,19 +64,110 @@ constexpr SmartCard::Protocol convertToSmartCardProtocol(const DWORD protocol)
     }
 }
 
-std::pair<SCARDHANDLE, DWORD> connectToCard(const SCARDCONTEXT ctx, const string_t& readerName)
+constexpr DWORD convertToScardProtocol(const SmartCard::Protocol protocol)
+{
+    switch (protocol) {
+    case SmartCard::Protocol::T0:
+        return SCARD_PROTOCOL_T0;
+    case SmartCard::Protocol::T1:
+        return SCARD_PROTOCOL_T1;
+    default:
+        return SCARD_PROTOCOL_UNDEFINED;
+    }
+}
+
+constexpr byte_type CLA_CHAINING = 0x10;
+
+/** Write one command chaining segment into the reusable segment buffer. */
+void setChainingSegment(byte_vector& segment, const CommandApdu& command, const bool isLast,
+                        const apdu_byte_vector::const_iterator dataBegin, const size_t dataSize)
+{
+    segment.clear();
+    segment.insert(segment.end(),
+                   {byte_type(isLast ? command.cla : command.cla | CLA_CHAINING), command.ins,
+                    command.p1, command.p2});
+
+    // Le is only sent in the last segment, Lc and Le must use the same encoding.
+    const bool extendedLe =
+        isLast && command.isLeSet() && *command.le > ResponseApdu::MAX_DATA_SIZE;
+    if (extendedLe) {
+        segment.insert(segment.end(), {0x00, 0x00, byte_type(dataSize)});
+    } else {
+        segment.push_back(byte_type(dataSize));
+    }
+    segment.insert(segment.end(), dataBegin, dataBegin + std::ptrdiff_t(dataSize));
+
+    if (isLast && command.isLeSet()) {
+        if (extendedLe) {
+            segment.push_back(byte_type(*command.le >> 8));
+        }
+        segment.push_back(byte_type(*command.le));
+    }
+}
+
+std::pair<SCARDHANDLE, DWORD> connectToCardInContext(const Context& ctx,
+                                                     const string_t& readerName)
 {
     const unsigned requestedProtocol =
         SCARD_PROTOCOL_T0 | SCARD_PROTOCOL_T1; // Let PCSC auto-select protocol.
     DWORD protocolOut = SCARD_PROTOCOL_UNDEFINED;
     SCARDHANDLE cardHandle = 0;
 
-    SCard(Connect, ctx, readerName.c_str(), DWORD(SCARD_SHARE_SHARED), requestedProtocol,
-          &cardHandle, &protocolOut);
+    const SCardCallReaderScope readerScope(readerName);
+    SCard(Connect, ctx.backend(), ctx.handle(), readerName.c_str(), DWORD(SCARD_SHARE_SHARED),
+          requestedProtocol, &cardHandle, &protocolOut);
 
     return std::pair<SCARDHANDLE, DWORD> {cardHandle, protocolOut};
 }
 
+std::pair<SCARDHANDLE, DWORD> connectToCard(Context& ctx, const string_t& readerName)
+{
+    const auto handle = ctx.handle();
+    try {
+        return connectToCardInContext(ctx, readerName);
+    } catch (const ScardServiceNotRunningError& /* e */) {
+        // The service may have been restarted, retry once in a new context.
+        ctx.reestablish(handle);
+        return connectToCardInContext(ctx, readerName);
+    }
+}
+
+constexpr byte_type INS_SELECT = 0xa4;
+
+bool isAbsoluteSelect(const CommandApdu& command)
+{
+    // Select by DF name, by path from MF or the MF itself.
+    return command.p1 == 0x04 || command.p1 == 0x08
+        || (command.p1 == 0x00
+            && (command.data.empty() || command.data == byte_vector {0x3f, 0x00}));
+}
+
+byte_vector responseCacheKey(const byte_vector& selectionContext, const byte_vector& commandBytes)
+{
+    // Prefix the context with its length so that different splits give different keys.
+    auto key = byte_vector {};
+    key.reserve(4 + selectionContext.size() + commandBytes.size());
+    const auto contextSize = uint32_t(selectionContext.size());
+    for (int shift = 24; shift >= 0; shift -= 8) {
+        key.push_back(byte_type(contextSize >> shift));
+    }
+    key.insert(key.end(), selectionContext.cbegin(), selectionContext.cend());
+    key.insert(key.end(), commandBytes.cbegin(), commandBytes.cend());
+    return key;
+}
+
+/** Pass the flight recorder contents to the dump handler when func throws Error. */
+template <typename Func>
+auto withFlightRecorderDump(Func func) -> decltype(func())
+{
+    try {
+        return func();
+    } catch (const Error& error) {
+        dumpFlightRecorder(error);
+        throw;
+    }
+}
+
 } // namespace
 
 namespace pcsc_cpp
@@ -78,33 +176,28 @@ namespace pcsc_cpp
 class CardImpl
 {
 public:
-    explicit CardImpl(std::pair<SCARDHANDLE, DWORD> cardParams) :
-        cardHandle(cardParams.first), _protocol({cardParams.second, sizeof(SCARD_IO_REQUEST)})
+    CardImpl(ContextPtr context, string_t reader, std::pair<SCARDHANDLE, DWORD> cardParams) :
+        ctx(std::move(context)), backend(ctx->backend()), readerName(std::move(reader)),
+        cardHandle(cardParams.first),
+        _protocol({cardParams.second, sizeof(SCARD_IO_REQUEST)})
     {
         // TODO: debug("Protocol: " + to_string(protocol()))
-        try {
-            DWORD size = 0;
-            std::array<BYTE, 256> feature {};
-            SCard(Control, cardHandle, DWORD(CM_IOCTL_GET_FEATURE_REQUEST), nullptr, 0U,
-                  feature.data(), DWORD(feature.size()), &size);
-            for (auto p = feature.cbegin(); DWORD(std::distance(feature.cbegin(), p)) < size;) {
-                auto tag = DRIVER_FEATURES(*p++);
-                uint32_t value = 0;
-                for (unsigned int i = 0, len = *p++; i < len; ++i)
-                    value |= uint32_t(*p++) << 8 * i;
-                features[tag] = ntohl(value);
-            }
-        } catch (const ScardError&) {
-            // Ignore driver errors during card feature requests.
-            // TODO: debug(error)
-        }
+    }
+
+    explicit CardImpl(std::unique_ptr<ApduSessionReplay> sessionReplay) :
+        backend(systemPcscBackend()), readerName(sessionReplay->session.reader), cardHandle(0),
+        _protocol({convertToScardProtocol(sessionReplay->session.protocol),
+                   sizeof(SCARD_IO_REQUEST)}),
+        replay(std::move(sessionReplay))
+    {
     }
 
     ~CardImpl()
     {
+        stopTransactionHoldThread();
         if (cardHandle) {
             // Cannot throw in destructor, so cannot use the SCard() macro here.
-            auto result = SCardDisconnect(cardHandle, SCARD_LEAVE_CARD);
+            auto result = backend.Disconnect(cardHandle, SCARD_LEAVE_CARD);
             cardHandle = 0;
             (void)result; // TODO: Log result here in case it is not OK.
         }
@@ -116,24 +209,76 @@ public:
     {
         if (getenv("SMARTCARDPP_NOPINPAD"))
             return false;
-        return features.find(FEATURE_VERIFY_PIN_START) != features.cend()
-            || features.find(FEATURE_VERIFY_PIN_DIRECT) != features.cend();
+        const auto& features = readerFeatures();
+        return features[FEATURE_VERIFY_PIN_START] || features[FEATURE_VERIFY_PIN_DIRECT];
     }
 
-    ResponseApdu transmitBytes(const byte_vector& commandBytes) const
+    ResponseApdu transmitBytes(const byte_vector& commandBytes,
+                               size_t responseBufferSize = ResponseApdu::MAX_SIZE) const
     {
-        byte_vector responseBytes(ResponseApdu::MAX_SIZE, 0);
-        auto responseLength = DWORD(responseBytes.size());
+        byte_vector responseBytes(responseBufferSize, 0);
+
+        const auto swOffset = transmitAndFollowStatus(commandBytes.data(), commandBytes.size(),
+                                                      responseBytes, 0, true);
+
+        return {responseBytes[swOffset], responseBytes[swOffset + 1],
+                apdu_byte_vector(responseBytes.cbegin(),
+                                 responseBytes.cbegin() + std::ptrdiff_t(swOffset))};
+    }
 
-        // TODO: debug("Sending:  " + bytes2hexstr(commandBytes))
+    ResponseApduView transmitBytes(const byte_vector& commandBytes,
+                                   byte_vector& responseBuffer) const
+    {
+        if (responseBuffer.size() < 2) {
+            THROW(std::invalid_argument, "Response buffer must have room for SW1 and SW2");
+        }
 
-        SCard(Transmit, cardHandle, &_protocol, commandBytes.data(), DWORD(commandBytes.size()),
-              nullptr, responseBytes.data(), &responseLength);
+        const auto swOffset = transmitAndFollowStatus(commandBytes.data(), commandBytes.size(),
+                                                      responseBuffer, 0, false);
 
-        auto response = toResponse(responseBytes, responseLength);
+        return {responseBuffer[swOffset], responseBuffer[swOffset + 1], responseBuffer.data(),
+                swOffset};
+    }
 
-        if (response.sw1 == ResponseApdu::MORE_DATA_AVAILABLE) {
-            getMoreResponseData(response);
+    /**
+     * Receive the response at offset in responseBuffer, which is grown as needed. Returns the
+     * offset of SW1.
+     */
+    size_t transmitBytes(const byte_vector& commandBytes, byte_vector& responseBuffer,
+                         const size_t offset, const size_t responseBufferSize) const
+    {
+        if (responseBuffer.size() < offset + responseBufferSize) {
+            responseBuffer.resize(offset + responseBufferSize);
+        }
+        return transmitAndFollowStatus(commandBytes.data(), commandBytes.size(), responseBuffer,
+                                       offset, true);
+    }
+
+    ResponseApdu transmitChained(const CommandApdu& command) const
+    {
+        // Header, Lc, data and Le, one buffer is reused for all segments.
+        byte_vector segment;
+        segment.reserve(4 + 3 + CommandApdu::MAX_DATA_SIZE + 2);
+
+        auto dataBegin = command.data.cbegin();
+        auto remaining = command.data.size();
+        ResponseApdu response;
+
+        while (remaining > 0) {
+            const auto segmentSize = std::min(remaining, CommandApdu::MAX_DATA_SIZE);
+            const bool isLast = segmentSize == remaining;
+
+            setChainingSegment(segment, command, isLast, dataBegin, segmentSize);
+            response = transmitBytes(segment, isLast ? command.responseBufferSize()
+                                                     : ResponseApdu::MAX_SIZE);
+
+            // Stop at the first intermediate error, the card has rejected the chain.
+            if (!isLast && !response.isOK()) {
+                break;
+            }
+
+            dataBegin += std::ptrdiff_t(segmentSize);
+            remaining -= segmentSize;
         }
 
         return response;
@@ -160,34 +305,322 @@ public:
         data->ulDataLength = uint32_t(commandBytes.size());
         cmd.insert(cmd.cend(), commandBytes.cbegin(), commandBytes.cend());
 
-        DWORD ioctl = features.at(features.find(FEATURE_VERIFY_PIN_START) != features.cend()
-                                      ? FEATURE_VERIFY_PIN_START
-                                      : FEATURE_VERIFY_PIN_DIRECT);
+        const auto& features = readerFeatures();
+        DWORD ioctl = features[FEATURE_VERIFY_PIN_START] ? features[FEATURE_VERIFY_PIN_START]
+                                                         : features[FEATURE_VERIFY_PIN_DIRECT];
+        if (!ioctl) {
+            THROW(Error, "Reader does not support PIN verification");
+        }
         byte_vector responseBytes(ResponseApdu::MAX_SIZE, 0);
         auto responseLength = DWORD(responseBytes.size());
-        SCard(Control, cardHandle, ioctl, cmd.data(), DWORD(cmd.size()),
-              LPVOID(responseBytes.data()), DWORD(responseBytes.size()), &responseLength);
+        ApduTrace trace(readerName, commandBytes.data(), commandBytes.size());
+        const SCardCallReaderScope readerScope(readerName);
+        SCardCall(
+            __FUNCTION__, __FILE__, __LINE__, "SCardControl",
+            [this](auto... args) { return sessionControl(args...); }, ioctl, cmd.data(),
+            DWORD(cmd.size()), responseBytes.data(), DWORD(responseBytes.size()), &responseLength);
 
-        if (features.find(FEATURE_VERIFY_PIN_FINISH) != features.cend()) {
-            DWORD finish = features.at(FEATURE_VERIFY_PIN_FINISH);
+        if (features[FEATURE_VERIFY_PIN_FINISH]) {
+            DWORD finish = features[FEATURE_VERIFY_PIN_FINISH];
             responseLength = DWORD(responseBytes.size());
-            SCard(Control, cardHandle, finish, nullptr, 0U, LPVOID(responseBytes.data()),
-                  DWORD(responseBytes.size()), &responseLength);
+            SCardCall(
+                __FUNCTION__, __FILE__, __LINE__, "SCardControl",
+                [this](auto... args) { return sessionControl(args...); }, finish, nullptr, 0U,
+                responseBytes.data(), DWORD(responseBytes.size()), &responseLength);
         }
 
+        trace.complete(responseBytes.data(),
+                       std::min(size_t(responseLength), responseBytes.size()));
         return toResponse(responseBytes, responseLength);
     }
 
-    void beginTransaction() const { SCard(BeginTransaction, cardHandle); }
+    void beginTransaction() const
+    {
+        if (replay) {
+            // A replayed card has no PC/SC transaction.
+            return;
+        }
+        // The PC/SC calls are made without holdMutex, SCardBeginTransaction() blocks while
+        // another process has a transaction.
+        bool releaseHeldTransaction = false;
+        {
+            std::unique_lock<std::mutex> lock(holdMutex);
+            holdChanged.wait(lock, [this] { return !releasingHeldTransaction; });
+            if (transactionHeld) {
+                transactionHeld = false;
+                if (Clock::now() - heldSince < maxHoldTime) {
+                    // Reuse the held transaction without a round trip to the PC/SC service.
+                    return;
+                }
+                // Give other processes a chance after the maximum hold time.
+                releaseHeldTransaction = true;
+            }
+        }
+        if (releaseHeldTransaction) {
+            releaseTransaction();
+        }
+        const SCardCallReaderScope readerScope(readerName);
+        SCard(BeginTransaction, backend, cardHandle);
+        std::lock_guard<std::mutex> lock(holdMutex);
+        heldSince = Clock::now();
+    }
+
+    void endTransaction() const
+    {
+        if (replay) {
+            return;
+        }
+        bool hold = false;
+        {
+            std::lock_guard<std::mutex> lock(holdMutex);
+            hold = idleTime.count() > 0 && Clock::now() - heldSince < maxHoldTime;
+            if (hold) {
+                transactionHeld = true;
+                idleSince = Clock::now();
+            }
+        }
+        if (!hold) {
+            const SCardCallReaderScope readerScope(readerName);
+            SCard(EndTransaction, backend, cardHandle, DWORD(SCARD_LEAVE_CARD));
+            return;
+        }
+        holdChanged.notify_all();
+    }
 
-    void endTransaction() const { SCard(EndTransaction, cardHandle, DWORD(SCARD_LEAVE_CARD)); }
+    void setTransactionHold(const std::chrono::milliseconds idle,
+                            const std::chrono::milliseconds maxHold)
+    {
+        bool releaseHeldTransaction = false;
+        {
+            std::lock_guard<std::mutex> lock(holdMutex);
+            idleTime = idle;
+            maxHoldTime = maxHold;
+            if (idleTime.count() == 0 && transactionHeld) {
+                transactionHeld = false;
+                releaseHeldTransaction = true;
+            }
+            if (idleTime.count() > 0 && !holdThread.joinable()) {
+                holdThread = std::thread([this] { releaseIdleTransactions(); });
+            }
+        }
+        if (releaseHeldTransaction) {
+            releaseTransaction();
+        }
+        holdChanged.notify_all();
+    }
 
     DWORD protocol() const { return _protocol.dwProtocol; }
 
+    bool isConnected() const
+    {
+        if (replay) {
+            return true;
+        }
+        // Reader name and ATR are not needed, SCardStatus() only reports the handle state.
+        DWORD readerNameLength = 0;
+        DWORD state = 0;
+        DWORD protocol = 0;
+        DWORD atrLength = 0;
+        return backend.Status(cardHandle, nullptr, &readerNameLength, &state, &protocol, nullptr,
+                              &atrLength)
+            == SCARD_S_SUCCESS;
+    }
+
+    /** Load the reader features first so that the feature request is not recorded. */
+    void startSessionRecording(ApduSession session)
+    {
+        const auto& loadedFeatures = readerFeatures();
+        session.reader = readerName;
+        session.readerFeatures.assign(loadedFeatures.cbegin(), loadedFeatures.cend());
+        recording = std::make_unique<ApduSessionRecording>(std::move(session));
+    }
+
+    ApduSession stopSessionRecording()
+    {
+        if (!recording) {
+            THROW(std::logic_error, "Session recording has not been started");
+        }
+        auto session = std::move(recording->session);
+        recording.reset();
+        return session;
+    }
+
 private:
+    using Clock = std::chrono::steady_clock;
+
+    ContextPtr ctx;
+    // A replayed card makes no PC/SC calls.
+    const PcscBackend& backend;
+    const string_t readerName;
     SCARDHANDLE cardHandle;
     const SCARD_IO_REQUEST _protocol;
-    std::map<DRIVER_FEATURES, uint32_t> features;
+    mutable std::optional<ReaderFeatures> features;
+
+    // Transaction hold state, see SmartCard::setTransactionHold(). The transaction is held when
+    // it is open while no TransactionGuard exists.
+    mutable std::mutex holdMutex;
+    mutable std::condition_variable holdChanged;
+    mutable bool transactionHeld = false;
+    // Set while holdThread ends the held transaction.
+    mutable bool releasingHeldTransaction = false;
+    mutable Clock::time_point heldSince;
+    mutable Clock::time_point idleSince;
+    std::chrono::milliseconds idleTime {0};
+    std::chrono::milliseconds maxHoldTime {0};
+    bool stopping = false;
+    std::thread holdThread;
+
+    // Set when the card is replayed from or recorded into a session, see SmartCard.
+    const std::unique_ptr<ApduSessionReplay> replay;
+    std::unique_ptr<ApduSessionRecording> recording;
+
+    /** SCardTransmit() that is replayed or recorded when a session is active. */
+    LONG sessionTransmit(const byte_type* command, const DWORD commandLength, byte_type* response,
+                         DWORD* responseLength) const
+    {
+        using Kind = ApduSession::Exchange::Kind;
+        if (replay) {
+            return replay->next(Kind::TRANSMIT, 0, command, commandLength, response,
+                                responseLength);
+        }
+        const auto start = ApduSessionRecording::Clock::now();
+        const auto result = backend.Transmit(cardHandle, &_protocol, command, commandLength,
+                                             nullptr, response, responseLength);
+        if (recording) {
+            recording->record(Kind::TRANSMIT, 0, result, start, command, commandLength, response,
+                              *responseLength);
+        }
+        return result;
+    }
+
+    /** SCardControl() that is replayed or recorded when a session is active. */
+    LONG sessionControl(const DWORD controlCode, const byte_type* command,
+                        const DWORD commandLength, byte_type* response,
+                        const DWORD responseBufferSize, DWORD* responseLength) const
+    {
+        using Kind = ApduSession::Exchange::Kind;
+        if (replay) {
+            *responseLength = responseBufferSize;
+            return replay->next(Kind::CONTROL, controlCode, command, commandLength, response,
+                                responseLength);
+        }
+        const auto start = ApduSessionRecording::Clock::now();
+        const auto result = backend.Control(cardHandle, controlCode, command, commandLength,
+                                            response, responseBufferSize, responseLength);
+        if (recording) {
+            recording->record(Kind::CONTROL, controlCode, result, start, command, commandLength,
+                              response, *responseLength);
+        }
+        return result;
+    }
+
+    /**
+     * End the transaction when it has been idle or held for too long, runs in holdThread. The
+     * card handle is used from this thread, see SmartCard::setTransactionHold().
+     */
+    void releaseIdleTransactions()
+    {
+        std::unique_lock<std::mutex> lock(holdMutex);
+        while (!stopping) {
+            if (!transactionHeld) {
+                holdChanged.wait(lock);
+                continue;
+            }
+            const auto deadline = std::min(idleSince + idleTime, heldSince + maxHoldTime);
+            if (Clock::now() >= deadline) {
+                // beginTransaction() waits until the transaction has ended.
+                transactionHeld = false;
+                releasingHeldTransaction = true;
+                lock.unlock();
+                releaseTransaction();
+                lock.lock();
+                releasingHeldTransaction = false;
+                holdChanged.notify_all();
+                continue;
+            }
+            holdChanged.wait_until(lock, deadline);
+        }
+    }
+
+    void stopTransactionHoldThread()
+    {
+        bool releaseHeldTransaction = false;
+        {
+            std::lock_guard<std::mutex> lock(holdMutex);
+            stopping = true;
+            if (transactionHeld) {
+                transactionHeld = false;
+                releaseHeldTransaction = true;
+            }
+        }
+        holdChanged.notify_all();
+        if (holdThread.joinable()) {
+            holdThread.join();
+        }
+        if (releaseHeldTransaction) {
+            releaseTransaction();
+        }
+    }
+
+    void releaseTransaction() const
+    {
+        // Errors are ignored, the transaction ends anyway when the card is removed or reset.
+        auto result = backend.EndTransaction(cardHandle, SCARD_LEAVE_CARD);
+        (void)result; // TODO: Log result here in case it is not OK.
+    }
+
+    /**
+     * Reader features are requested with CM_IOCTL_GET_FEATURE_REQUEST on first use and cached in
+     * the context by reader name, so that connecting to a card costs no feature request.
+     */
+    const ReaderFeatures& readerFeatures() const
+    {
+        if (!features && replay) {
+            // The features are recorded with the session instead of the feature request.
+            const auto& recorded = replay->session.readerFeatures;
+            features = ReaderFeatures {};
+            std::copy_n(recorded.cbegin(), std::min(recorded.size(), features->size()),
+                        features->begin());
+        }
+        if (!features) {
+            features = ctx->readerFeatures(readerName);
+        }
+        if (!features) {
+            features = requestReaderFeatures();
+            ctx->setReaderFeatures(readerName, *features);
+        }
+        return *features;
+    }
+
+    ReaderFeatures requestReaderFeatures() const
+    {
+        ReaderFeatures result {};
+        try {
+            DWORD size = 0;
+            std::array<BYTE, 256> feature {};
+            const SCardCallReaderScope readerScope(readerName);
+            SCard(Control, backend, cardHandle, DWORD(CM_IOCTL_GET_FEATURE_REQUEST), nullptr, 0U,
+                  feature.data(), DWORD(feature.size()), &size);
+            // Each TLV has a one byte tag, one byte length and the control code.
+            for (size_t i = 0; i + 2 <= size;) {
+                const auto tag = feature[i++];
+                const auto len = feature[i++];
+                if (i + len > size) {
+                    break;
+                }
+                uint32_t value = 0;
+                for (unsigned int j = 0; j < len; ++j)
+                    value |= uint32_t(feature[i++]) << 8 * j;
+                if (tag < result.size()) {
+                    result[tag] = ntohl(value);
+                }
+            }
+        } catch (const ScardError&) {
+            // Ignore driver errors during card feature requests.
+            // TODO: debug(error)
+        }
+        return result;
+    }
 
     ResponseApdu toResponse(byte_vector& responseBytes, size_t responseLength) const
     {
@@ -196,62 +629,215 @@ private:
         }
         responseBytes.resize(responseLength);
 
-        // TODO: debug("Received: " + bytes2hexstr(responseBytes))
-
         auto response = ResponseApdu::fromBytes(responseBytes);
 
-        // Let expected errors through for handling in upper layers or in if blocks below.
-        switch (response.sw1) {
+        verifyResponseStatus(response.sw1, response.sw2);
+
+        if (response.sw1 == ResponseApdu::WRONG_LE_LENGTH) {
+            THROW(Error, "Wrong LE length (SW1=0x6C) in response, please set LE");
+        }
+
+        return response;
+    }
+
+    void verifyResponseStatus(const byte_type sw1, const byte_type sw2) const
+    {
+        // Let expected errors through for handling in upper layers or in transmit loops.
+        switch (sw1) {
         case ResponseApdu::OK:
-        case ResponseApdu::MORE_DATA_AVAILABLE: // See the if block after next.
+        case ResponseApdu::MORE_DATA_AVAILABLE: // See transmitAndFollowStatus().
         case ResponseApdu::VERIFICATION_FAILED:
         case ResponseApdu::VERIFICATION_CANCELLED:
         case ResponseApdu::WRONG_LENGTH:
         case ResponseApdu::COMMAND_NOT_ALLOWED:
         case ResponseApdu::WRONG_PARAMETERS:
-        case ResponseApdu::WRONG_LE_LENGTH: // See next if block.
+        case ResponseApdu::WRONG_LE_LENGTH: // See transmitAndFollowStatus().
             break;
         default:
             THROW(Error,
-                  "Error response: '" + bytes2hexstr({response.sw1, response.sw2}) + "', protocol "
+                  "Error response: '" + bytes2hexstr({sw1, sw2}) + "', protocol "
                       + std::to_string(protocol()));
         }
+    }
 
-        if (response.sw1 == ResponseApdu::WRONG_LE_LENGTH) {
+    /** Receive the response at offset in responseBuffer, returns the offset of SW1. */
+    size_t transmitIntoBuffer(const byte_type* commandBytes, const size_t commandLength,
+                              byte_vector& responseBuffer, const size_t offset) const
+    {
+        auto responseLength = DWORD(responseBuffer.size() - offset);
+
+        ApduTrace trace(readerName, commandBytes, commandLength);
+        const SCardCallReaderScope readerScope(readerName);
+        SCardCall(
+            __FUNCTION__, __FILE__, __LINE__, "SCardTransmit",
+            [this](auto... args) { return sessionTransmit(args...); }, commandBytes,
+            DWORD(commandLength), responseBuffer.data() + offset, &responseLength);
+        trace.complete(responseBuffer.data() + offset,
+                       std::min(size_t(responseLength), responseBuffer.size() - offset));
+
+        if (offset + responseLength > responseBuffer.size()) {
+            THROW(Error, "SCardTransmit: received more bytes than buffer size");
+        }
+        if (responseLength < 2) {
+            THROW(Error, "SCardTransmit: response is shorter than 2 status bytes");
+        }
+
+        const auto swOffset = offset + responseLength - 2;
+        verifyResponseStatus(responseBuffer[swOffset], responseBuffer[swOffset + 1]);
+        return swOffset;
+    }
+
+    /**
+     * Transmit the command, retry once with the Le from SW2 on 0x6C and collect the remaining
+     * data with GET RESPONSE on 0x61 in a single loop. The data of all responses is placed
+     * contiguously in responseBuffer starting at offset, the buffer is grown from the SW2 length
+     * hints if canGrow is set. Returns the offset of SW1 in responseBuffer.
+     */
+    size_t transmitAndFollowStatus(const byte_type* commandBytes, const size_t commandLength,
+                                   byte_vector& responseBuffer, const size_t offset,
+                                   const bool canGrow) const
+    {
+        std::array<byte_type, SHORT_APDU_MAX_SIZE> correctedCommand {};
+        std::array<byte_type, 5> getResponseCommand {0x00, 0xc0, 0x00, 0x00, 0x00};
+
+        auto* lastCommand = commandBytes;
+        auto lastCommandLength = commandLength;
+        size_t lastOffset = offset;
+        bool leCorrected = false;
+
+        auto swOffset = transmitIntoBuffer(lastCommand, lastCommandLength, responseBuffer, offset);
+
+        while (true) {
+            const auto sw1 = responseBuffer[swOffset];
+            const auto sw2 = responseBuffer[swOffset + 1];
+
+            if (sw1 == ResponseApdu::WRONG_LE_LENGTH && !leCorrected) {
+                // Resend the same command with the exact Le from SW2 into the same place.
+                const auto correctedLength =
+                    setShortApduLe(lastCommand, lastCommandLength, sw2, correctedCommand);
+                if (correctedLength == 0) {
+                    break;
+                }
+                leCorrected = true;
+                lastCommand = correctedCommand.data();
+                lastCommandLength = correctedLength;
+                ensureResponseCapacity(responseBuffer, lastOffset, sw2, canGrow);
+
+            } else if (sw1 == ResponseApdu::MORE_DATA_AVAILABLE) {
+                // Append after the data received so far, overwriting SW1 and SW2.
+                leCorrected = false;
+                getResponseCommand[4] = sw2;
+                lastCommand = getResponseCommand.data();
+                lastCommandLength = getResponseCommand.size();
+                lastOffset = swOffset;
+                ensureResponseCapacity(responseBuffer, lastOffset, sw2, canGrow);
+
+            } else {
+                break;
+            }
+
+            swOffset = transmitIntoBuffer(lastCommand, lastCommandLength, responseBuffer,
+                                          lastOffset);
+        }
+
+        if (responseBuffer[swOffset] == ResponseApdu::WRONG_LE_LENGTH) {
             THROW(Error, "Wrong LE length (SW1=0x6C) in response, please set LE");
         }
 
-        return response;
+        return swOffset;
     }
 
-    void getMoreResponseData(ResponseApdu& response) const
+    static void ensureResponseCapacity(byte_vector& responseBuffer, const size_t offset,
+                                       const byte_type le, const bool canGrow)
     {
-        byte_vector getResponseCommand {0x00, 0xc0, 0x00, 0x00, 0x00};
+        // Le 0 means 256 bytes, add room for SW1 and SW2.
+        const auto required = offset + (le ? le : ResponseApdu::MAX_DATA_SIZE) + 2;
+        if (responseBuffer.size() >= required) {
+            return;
+        }
+        if (!canGrow) {
+            THROW(Error, "Response buffer is too small for the remaining response data");
+        }
+        responseBuffer.resize(required);
+    }
+
+    /**
+     * Copy the command APDU to correctedCommand with Le replaced or added, returns the corrected
+     * command length or 0 if the command cannot be corrected. SW2 cannot carry a 2-byte Le, so
+     * an extended command is converted to a short one if its data fits.
+     */
+    static size_t setShortApduLe(const byte_type* command, const size_t length, const byte_type le,
+                                 std::array<byte_type, SHORT_APDU_MAX_SIZE>& correctedCommand)
+    {
+        if (length >= 7 && command[4] == 0x00) {
+            return setExtendedApduLe(command, length, le, correctedCommand);
+        }
 
-        auto newResponse = ResponseApdu(response.sw1, response.sw2);
+        size_t leOffset = 0;
+        if (length == 4 || length == 5) {
+            // Case 1 without Le or case 2 with Le in the last byte.
+            leOffset = 4;
+        } else if (length > 5 && command[4] != 0x00) {
+            const size_t lc = command[4];
+            if (length == 5 + lc) {
+                leOffset = length; // Case 3 without Le.
+            } else if (length == 6 + lc) {
+                leOffset = length - 1; // Case 4 with Le in the last byte.
+            } else {
+                return 0;
+            }
+        } else {
+            return 0;
+        }
+
+        std::copy(command, command + leOffset, correctedCommand.begin());
+        correctedCommand[leOffset] = le;
+        return leOffset + 1;
+    }
 
-        while (newResponse.sw1 == ResponseApdu::MORE_DATA_AVAILABLE) {
-            getResponseCommand[4] = newResponse.sw2;
-            newResponse = transmitBytes(getResponseCommand);
-            response.data.insert(response.data.end(), newResponse.data.cbegin(),
-                                 newResponse.data.cend());
+    static size_t setExtendedApduLe(const byte_type* command, const size_t length,
+                                    const byte_type le,
+                                    std::array<byte_type, SHORT_APDU_MAX_SIZE>& correctedCommand)
+    {
+        size_t dataLength = 0;
+        if (length != 7) {
+            // Case 3 or 4 with the 2-byte Lc after the 0x00 marker.
+            dataLength = size_t(command[5]) << 8 | command[6];
+            if (dataLength == 0 || dataLength > CommandApdu::MAX_DATA_SIZE
+                || (length != 7 + dataLength && length != 9 + dataLength)) {
+                return 0;
+            }
         }
 
-        response.sw1 = ResponseApdu::OK;
-        response.sw2 = 0;
+        std::copy(command, command + 4, correctedCommand.begin());
+        size_t leOffset = 4;
+        if (dataLength != 0) {
+            correctedCommand[leOffset++] = byte_type(dataLength);
+            std::copy(command + 7, command + 7 + dataLength,
+                      correctedCommand.begin() + std::ptrdiff_t(leOffset));
+            leOffset += dataLength;
+        }
+        correctedCommand[leOffset] = le;
+        return leOffset + 1;
     }
 };
 
-SmartCard::TransactionGuard::TransactionGuard(const CardImpl& card, bool& inProgress) :
-    card(card), inProgress(inProgress)
+SmartCard::TransactionGuard::TransactionGuard(const CardImpl& card,
+                                              std::atomic<unsigned>& depth) :
+    card(card), depth(depth)
 {
-    card.beginTransaction();
-    inProgress = true;
+    // Only the outermost guard begins and ends the PC/SC transaction.
+    if (depth == 0) {
+        card.beginTransaction();
+    }
+    ++depth;
 }
 
 SmartCard::TransactionGuard::~TransactionGuard()
 {
-    inProgress = false;
+    if (--depth > 0) {
+        return;
+    }
     try {
         card.endTransaction();
     } catch (...) {
@@ -260,19 +846,57 @@ SmartCard::TransactionGuard::~TransactionGuard()
 }
 
 SmartCard::SmartCard(const ContextPtr& contex, const string_t& readerName, byte_vector atr) :
-    card(std::make_unique<CardImpl>(connectToCard(contex->handle(), readerName))),
+    card(std::make_unique<CardImpl>(contex, readerName, connectToCard(*contex, readerName))),
     _atr(std::move(atr)), _protocol(convertToSmartCardProtocol(card->protocol()))
 {
     // TODO: debug("Card ATR -> " + bytes2hexstr(atr))
 }
 
+SmartCard::SmartCard(ApduSession session, const ReplayPace pace) :
+    _atr(session.atr), _protocol(session.protocol)
+{
+    auto replay = std::make_unique<ApduSessionReplay>(std::move(session), pace);
+    card = std::make_unique<CardImpl>(std::move(replay));
+}
+
 SmartCard::SmartCard() = default;
 SmartCard::~SmartCard() = default;
 
 SmartCard::TransactionGuard SmartCard::beginTransaction()
 {
     REQUIRE_NON_NULL(card)
-    return {*card, transactionInProgress};
+    return {*card, transactionDepth};
+}
+
+void SmartCard::setTransactionHold(std::chrono::milliseconds idleTime,
+                                   std::chrono::milliseconds maxHoldTime)
+{
+    REQUIRE_NON_NULL(card)
+    if (idleTime.count() < 0 || (idleTime.count() > 0 && maxHoldTime < idleTime)) {
+        THROW(std::invalid_argument,
+              "Transaction hold idle time must not be negative or exceed maximum hold time");
+    }
+    card->setTransactionHold(idleTime, maxHoldTime);
+}
+
+bool SmartCard::isConnected() const
+{
+    return card ? card->isConnected() : false;
+}
+
+void SmartCard::startSessionRecording()
+{
+    REQUIRE_NON_NULL(card)
+    ApduSession session;
+    session.atr = _atr;
+    session.protocol = _protocol;
+    card->startSessionRecording(std::move(session));
+}
+
+ApduSession SmartCard::stopSessionRecording()
+{
+    REQUIRE_NON_NULL(card)
+    return card->stopSessionRecording();
 }
 
 bool SmartCard::readerHasPinPad() const
@@ -283,21 +907,206 @@ bool SmartCard::readerHasPinPad() const
 ResponseApdu SmartCard::transmit(const CommandApdu& command) const
 {
     REQUIRE_NON_NULL(card)
-    if (!transactionInProgress) {
+    if (transactionDepth == 0) {
         THROW(std::logic_error, "Call SmartCard::transmit() inside a transaction");
     }
 
-    return card->transmitBytes(command.toBytes());
+    return withFlightRecorderDump([&] {
+        if (responseCache) {
+            return transmitCached(command);
+        }
+        return transmitCommand(command);
+    });
+}
+
+ResponseApdu SmartCard::transmitCommand(const CommandApdu& command) const
+{
+    if (command.data.size() > CommandApdu::MAX_DATA_SIZE && !_extendedLengthSupported) {
+        return card->transmitChained(command);
+    }
+
+    return card->transmitBytes(command.toBytes(), command.responseBufferSize());
+}
+
+ResponseApdu SmartCard::transmitCached(const CommandApdu& command) const
+{
+    const bool isSelect = command.ins == INS_SELECT;
+    const bool isAbsolute = isSelect && isAbsoluteSelect(command);
+    const auto commandBytes = command.toBytes();
+
+    // SELECT commands update the selection context that the following commands are keyed with,
+    // an empty context means that the current file is not known.
+    auto nextSelectionContext = byte_vector {};
+    if (isAbsolute || (isSelect && !selectionContext.empty())) {
+        nextSelectionContext = isAbsolute ? byte_vector {} : selectionContext;
+        nextSelectionContext.insert(nextSelectionContext.end(), commandBytes.cbegin(),
+                                    commandBytes.cend());
+    }
+
+    const bool isCacheable = responseCache->isIdempotent(command)
+        && (isAbsolute || !selectionContext.empty());
+    const auto key = isCacheable
+        ? responseCacheKey(isAbsolute ? byte_vector {} : selectionContext, commandBytes)
+        : byte_vector {};
+
+    if (isCacheable) {
+        if (auto response = responseCache->find(_atr, responseCacheCardSerial, key)) {
+            if (isSelect) {
+                if (isAbsolute) {
+                    pendingSelects.clear();
+                }
+                pendingSelects.push_back(command);
+                selectionContext = std::move(nextSelectionContext);
+            }
+            return std::move(*response);
+        }
+    }
+
+    try {
+        transmitPendingSelects();
+        auto response = transmitCommand(command);
+
+        if (response.isOK()) {
+            if (isSelect) {
+                selectionContext = std::move(nextSelectionContext);
+            }
+            if (isCacheable) {
+                responseCache->store(_atr, responseCacheCardSerial, key, response);
+            } else if (!isSelect && !responseCache->isIdempotent(command)) {
+                // The command may have modified cached files.
+                responseCache->invalidate(_atr, responseCacheCardSerial);
+            }
+        }
+        return response;
+
+    } catch (const ScardCardRemovedError&) {
+        responseCache->invalidate(_atr, responseCacheCardSerial);
+        throw;
+    } catch (const ScardCardCommunicationFailedError&) {
+        responseCache->invalidate(_atr, responseCacheCardSerial);
+        throw;
+    }
+}
+
+void SmartCard::transmitPendingSelects() const
+{
+    // Move the commands out first, a failing SELECT must not be retried with the next command.
+    const auto selects = std::move(pendingSelects);
+    pendingSelects.clear();
+    for (const auto& select : selects) {
+        const auto response = transmitCommand(select);
+        if (!response.isOK()) {
+            selectionContext.clear();
+            responseCache->invalidate(_atr, responseCacheCardSerial);
+            THROW(Error,
+                  "Cached SELECT failed with '" + bytes2hexstr(response.toBytes())
+                      + "', the card has changed");
+        }
+    }
+}
+
+void SmartCard::setResponseCache(std::shared_ptr<ResponseCache> cache, std::string cardSerial)
+{
+    responseCache = std::move(cache);
+    responseCacheCardSerial = std::move(cardSerial);
+    selectionContext.clear();
+    pendingSelects.clear();
+}
+
+ResponseApduView SmartCard::transmit(const byte_vector& commandBytes,
+                                     byte_vector& responseBuffer) const
+{
+    REQUIRE_NON_NULL(card)
+    if (transactionDepth == 0) {
+        THROW(std::logic_error, "Call SmartCard::transmit() inside a transaction");
+    }
+
+    return withFlightRecorderDump([&] {
+        transmitPendingSelects();
+        // The commands are not seen by the response cache, the current file is unknown and the
+        // commands may modify cached files.
+        selectionContext.clear();
+        if (responseCache) {
+            responseCache->invalidate(_atr, responseCacheCardSerial);
+        }
+        return card->transmitBytes(commandBytes, responseBuffer);
+    });
+}
+
+BatchResponse
+SmartCard::transmitBatch(const std::vector<CommandApdu>& commands,
+                         const std::function<bool(const ResponseApduView&)>& continueIf)
+{
+    REQUIRE_NON_NULL(card)
+
+    const auto transactionGuard = beginTransaction();
+
+    return withFlightRecorderDump([&] {
+        transmitPendingSelects();
+        // The commands are not seen by the response cache, the current file is unknown and the
+        // commands may modify cached files.
+        selectionContext.clear();
+        if (responseCache) {
+            responseCache->invalidate(_atr, responseCacheCardSerial);
+        }
+
+        BatchResponse response;
+        response.records.reserve(commands.size());
+        response.arena.reserve(commands.size() * ResponseApdu::MAX_SIZE);
+        // One command buffer is reused for all commands.
+        byte_vector commandBytes;
+        size_t arenaSize = 0;
+
+        for (const auto& command : commands) {
+            BatchResponse::Record record {arenaSize, 0, 0, 0};
+
+            if (command.data.size() > CommandApdu::MAX_DATA_SIZE && !_extendedLengthSupported) {
+                const auto chainedResponse = card->transmitChained(command);
+                response.arena.resize(arenaSize);
+                response.arena.insert(response.arena.end(), chainedResponse.data.cbegin(),
+                                      chainedResponse.data.cend());
+                record.length = chainedResponse.data.size();
+                record.sw1 = chainedResponse.sw1;
+                record.sw2 = chainedResponse.sw2;
+
+            } else {
+                command.toBytes(commandBytes);
+                // The status bytes are kept in the record, the next response overwrites them.
+                const auto swOffset = card->transmitBytes(commandBytes, response.arena, arenaSize,
+                                                          command.responseBufferSize());
+                record.length = swOffset - arenaSize;
+                record.sw1 = response.arena[swOffset];
+                record.sw2 = response.arena[swOffset + 1];
+            }
+
+            arenaSize += record.length;
+            response.records.push_back(record);
+
+            const auto view = ResponseApduView {
+                record.sw1, record.sw2, response.arena.data() + record.offset, record.length};
+            if (continueIf ? !continueIf(view) : !view.isOK()) {
+                break;
+            }
+        }
+
+        response.arena.resize(arenaSize);
+        return response;
+    });
 }
 
 ResponseApdu SmartCard::transmitCTL(const CommandApdu& command, uint16_t lang, uint8_t minlen) const
 {
     REQUIRE_NON_NULL(card)
-    if (!transactionInProgress) {
+    if (transactionDepth == 0) {
         THROW(std::logic_error, "Call SmartCard::transmit() inside a transaction");
     }
 
-    return card->transmitBytesCTL(command.toBytes(), lang, minlen);
+    return withFlightRecorderDump([&] {
+        transmitPendingSelects();
+        // The commands are not seen by the response cache, the current file is unknown.
+        selectionContext.clear();
+        return card->transmitBytesCTL(command.toBytes(), lang, minlen);
+    });
 }
 
 } // namespace pcsc_cpp
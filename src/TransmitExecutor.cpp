@@ -0,0 +1,156 @@
+/*
+ * Copyright (c) 2020-2023 Estonian Information System Authority
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "pcsc-cpp/pcsc-cpp.hpp"
+#include "pcsc-cpp/pcsc-cpp-utils.hpp"
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+
+namespace pcsc_cpp
+{
+
+class TransmitExecutor::Impl
+{
+public:
+    Impl(const size_t threadCount, const size_t queueDepth) : maxQueueDepth(queueDepth)
+    {
+        if (threadCount == 0 || maxQueueDepth == 0) {
+            THROW(std::invalid_argument,
+                  "TransmitExecutor: thread count and queue depth must be positive");
+        }
+        threads.reserve(threadCount);
+        for (size_t i = 0; i < threadCount; ++i) {
+            threads.emplace_back([this] { run(); });
+        }
+    }
+
+    ~Impl()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        workAvailable.notify_all();
+        spaceAvailable.notify_all();
+        for (auto& thread : threads) {
+            thread.join();
+        }
+    }
+
+    PCSC_CPP_DISABLE_COPY_MOVE(Impl);
+
+    std::future<ResponseApdu> submit(const SmartCard& card, CommandApdu command)
+    {
+        auto task = std::make_shared<std::packaged_task<ResponseApdu()>>(
+            [&card, command = std::move(command)] { return card.transmit(command); });
+        auto future = task->get_future();
+
+        std::unique_lock<std::mutex> lock(mutex);
+        // Backpressure: block the submitter while the card queue is full.
+        spaceAvailable.wait(lock, [this, &card] {
+            return stopping || cardQueues[&card].tasks.size() < maxQueueDepth;
+        });
+        if (stopping) {
+            THROW(std::logic_error, "TransmitExecutor: executor is being destroyed");
+        }
+
+        auto& cardQueue = cardQueues[&card];
+        cardQueue.tasks.emplace_back([task] { (*task)(); });
+        if (!cardQueue.scheduled) {
+            cardQueue.scheduled = true;
+            readyCards.push_back(&card);
+            lock.unlock();
+            workAvailable.notify_one();
+        }
+        return future;
+    }
+
+private:
+    /** Serial queue of a single card, scheduled on at most one thread at a time. */
+    struct CardQueue
+    {
+        std::deque<std::function<void()>> tasks;
+        bool scheduled = false;
+    };
+
+    void run()
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        while (true) {
+            workAvailable.wait(lock, [this] { return stopping || !readyCards.empty(); });
+            // Pending transmits are completed before the executor stops.
+            if (readyCards.empty()) {
+                return;
+            }
+
+            const auto* card = readyCards.front();
+            readyCards.pop_front();
+            auto& cardQueue = cardQueues[card];
+            auto task = std::move(cardQueue.tasks.front());
+            cardQueue.tasks.pop_front();
+
+            lock.unlock();
+            task();
+            lock.lock();
+
+            // Round-robin between cards, a busy card does not starve the others.
+            if (cardQueue.tasks.empty()) {
+                cardQueues.erase(card);
+            } else {
+                readyCards.push_back(card);
+                workAvailable.notify_one();
+            }
+            spaceAvailable.notify_all();
+        }
+    }
+
+    const size_t maxQueueDepth;
+
+    std::mutex mutex;
+    std::condition_variable workAvailable;
+    std::condition_variable spaceAvailable;
+    std::unordered_map<const SmartCard*, CardQueue> cardQueues;
+    std::deque<const SmartCard*> readyCards;
+    bool stopping = false;
+
+    // Must be last, the threads start running in the constructor.
+    std::vector<std::thread> threads;
+};
+
+TransmitExecutor::TransmitExecutor(size_t threadCount, size_t maxQueueDepth) :
+    impl(std::make_unique<Impl>(threadCount, maxQueueDepth))
+{
+}
+
+TransmitExecutor::~TransmitExecutor() = default;
+
+std::future<ResponseApdu> TransmitExecutor::transmitAsync(const SmartCard& card,
+                                                          CommandApdu command)
+{
+    return impl->submit(card, std::move(command));
+}
+
+} // namespace pcsc_cpp
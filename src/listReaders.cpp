@@ -22,46 +22,17 @@
 
 #include "pcsc-cpp/pcsc-cpp.hpp"
 
-#include "Context.hpp"
+#include "ReaderStates.hpp"
 
-#include <cstring>
 #include <memory>
 #include <algorithm>
-#include <map>
 
 namespace
 {
 
 using namespace pcsc_cpp;
 
-inline DWORD updateReaderNamesBuffer(const SCARDCONTEXT ctx, string_t::value_type* buffer,
-                                     const DWORD bufferLength = 0)
-{
-    auto bufferLengthOut = bufferLength;
-    SCard(ListReaders, ctx, nullptr, buffer, &bufferLengthOut);
-    return bufferLengthOut;
-}
-
-std::vector<const string_t::value_type*> getReaderNamePointerList(const string_t& readerNames)
-{
-    auto readerNamePointerList = std::vector<const string_t::value_type*> {};
-
-    if (readerNames.empty())
-        return readerNamePointerList;
-
-        // Reader names are \0 separated and end with double \0.
-#ifdef _WIN32
-    for (const string_t::value_type* name = readerNames.c_str(); *name; name += wcslen(name) + 1) {
-#else
-    for (const string_t::value_type* name = readerNames.c_str(); *name; name += strlen(name) + 1) {
-#endif
-        readerNamePointerList.push_back(name);
-    }
-
-    return readerNamePointerList;
-}
-
-std::vector<SCARD_READERSTATE> getReaderStates(const SCARDCONTEXT ctx, const string_t& readerNames)
+std::vector<SCARD_READERSTATE> getReaderStates(const Context& ctx, const string_t& readerNames)
 {
     auto readerStates = std::vector<SCARD_READERSTATE> {};
     for (const auto& readerNamePointer : getReaderNamePointerList(readerNames)) {
@@ -78,82 +49,61 @@ std::vector<SCARD_READERSTATE> getReaderStates(const SCARDCONTEXT ctx, const str
     if (readerStates.empty())
         return {};
 
-    SCard(GetStatusChange, ctx, 0U, readerStates.data(), DWORD(readerStates.size()));
+    SCard(GetStatusChange, ctx.backend(), ctx.handle(), 0U, readerStates.data(),
+          DWORD(readerStates.size()));
 
     return readerStates;
 }
 
-inline flag_set<Reader::Status> flagSetFromReaderState(const DWORD readerState)
+std::vector<Reader> listReadersInContext(const ContextPtr& ctx)
 {
-    if (!readerState) {
-        return flag_set<Reader::Status> {Reader::Status::UNAWARE};
-    }
+    try {
+        auto readerNames = populateReaderNames(*ctx);
 
-    static const std::map<DWORD, Reader::Status> READER_STATUS_MAP = {
-        // SCARD_STATE_UNAWARE is zero and covered with (!readerState) above.
-        {SCARD_STATE_IGNORE, Reader::Status::IGNORE},
-        {SCARD_STATE_CHANGED, Reader::Status::CHANGED},
-        {SCARD_STATE_UNKNOWN, Reader::Status::UNKNOWN},
-        {SCARD_STATE_UNAVAILABLE, Reader::Status::UNAVAILABLE},
-        {SCARD_STATE_EMPTY, Reader::Status::EMPTY},
-        {SCARD_STATE_PRESENT, Reader::Status::PRESENT},
-        {SCARD_STATE_ATRMATCH, Reader::Status::ATRMATCH},
-        {SCARD_STATE_EXCLUSIVE, Reader::Status::EXCLUSIVE},
-        {SCARD_STATE_INUSE, Reader::Status::INUSE},
-        {SCARD_STATE_MUTE, Reader::Status::MUTE},
-        {SCARD_STATE_UNPOWERED, Reader::Status::UNPOWERED}};
-
-    auto result = flag_set<Reader::Status> {};
-
-    for (const auto& [key, value] : READER_STATUS_MAP) {
-        if (readerState & key) {
-            result.set(value);
+        auto readers = std::vector<Reader> {};
+        for (const auto& readerState : getReaderStates(*ctx, readerNames)) {
+            readers.emplace_back(makeReader(ctx, readerState));
         }
+        return readers;
+    } catch (const ScardNoReadersError& /* e */) {
+        return std::vector<Reader> {};
     }
-
-    return result;
 }
 
-inline Reader makeReader(const ContextPtr& ctx, const SCARD_READERSTATE& readerState)
-{
-    return Reader {ctx, readerState.szReader,
-                   byte_vector {readerState.rgbAtr, readerState.rgbAtr + readerState.cbAtr},
-                   flagSetFromReaderState(readerState.dwEventState)};
-}
+} // anonymous namespace
 
-string_t populateReaderNames(const SCARDCONTEXT ctx)
+namespace pcsc_cpp
 {
-    // Buffer length is in characters, not bytes.
-    const auto bufferLength = updateReaderNamesBuffer(ctx, nullptr);
 
-    auto readerNames = string_t(bufferLength, 0);
-
-    // The returned buffer length is no longer useful, ignore it.
-    updateReaderNamesBuffer(ctx, readerNames.data(), bufferLength);
-
-    return readerNames;
+ContextPtr establishContext()
+{
+    return std::make_shared<Context>();
 }
 
-} // anonymous namespace
-
-namespace pcsc_cpp
+ContextPtr establishContext(const PcscBackend& backend)
 {
+    return std::make_shared<Context>(backend);
+}
 
-std::vector<Reader> listReaders()
+std::vector<Reader> listReaders(const ContextPtr& ctx)
 {
-    auto ctx = std::make_shared<Context>();
+    REQUIRE_NON_NULL(ctx)
 
-    try {
-        auto readerNames = populateReaderNames(ctx->handle());
+    ctx->ensureValid();
+    const auto handle = ctx->handle();
 
-        auto readers = std::vector<Reader> {};
-        for (const auto& readerState : getReaderStates(ctx->handle(), readerNames)) {
-            readers.emplace_back(makeReader(ctx, readerState));
-        }
-        return readers;
-    } catch (const ScardNoReadersError& /* e */) {
-        return std::vector<Reader> {};
+    try {
+        return listReadersInContext(ctx);
+    } catch (const ScardServiceNotRunningError& /* e */) {
+        // The service may have been restarted, retry once in a new context.
+        ctx->reestablish(handle);
+        return listReadersInContext(ctx);
     }
 }
 
+std::vector<Reader> listReaders()
+{
+    return listReadersInContext(establishContext());
+}
+
 } // namespace pcsc_cpp
@@ -0,0 +1,218 @@
+/*
+ * Copyright (c) 2020-2023 Estonian Information System Authority
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "pcsc-cpp/pcsc-cpp.hpp"
+#include "pcsc-cpp/pcsc-cpp-utils.hpp"
+
+#include <array>
+
+using namespace std::string_literals;
+
+namespace
+{
+
+using namespace pcsc_cpp;
+
+constexpr byte_type TS_DIRECT_CONVENTION = 0x3b;
+constexpr byte_type TS_INVERSE_CONVENTION = 0x3f;
+
+// ISO/IEC 7816-3 table 7, reserved values are 0.
+constexpr std::array<uint16_t, 16> FI_TABLE {372, 372, 558, 744, 1116, 1488, 1860, 0,
+                                             0,   512, 768, 1024, 1536, 2048, 0, 0};
+constexpr std::array<uint16_t, 16> FMAX_KHZ_TABLE {4000, 5000,  6000,  8000, 12000, 16000,
+                                                   20000, 0,   0,     5000, 7500,  10000,
+                                                   15000, 20000, 0,   0};
+// ISO/IEC 7816-3 table 8.
+constexpr std::array<uint8_t, 16> DI_TABLE {0, 1, 2, 4, 8, 16, 32, 64, 12, 20, 0, 0, 0, 0, 0, 0};
+
+// ISO/IEC 7816-4 section 8.1.1.2.7, third software function table byte.
+constexpr byte_type COMPACT_TLV_CARD_CAPABILITIES_TAG = 0x7;
+constexpr byte_type CAPABILITY_COMMAND_CHAINING = 0x80;
+constexpr byte_type CAPABILITY_EXTENDED_LENGTH = 0x40;
+
+void parseHistoricalBytes(AtrInfo& info)
+{
+    const auto& bytes = info.historicalBytes;
+    if (bytes.empty()) {
+        return;
+    }
+
+    // Category indicator 0x00 ends with a 3-byte status indicator, 0x80 has only TLV objects.
+    size_t end = bytes.size();
+    if (bytes[0] == 0x00) {
+        if (end < 4) {
+            return;
+        }
+        end -= 3;
+    } else if (bytes[0] != 0x80) {
+        return;
+    }
+
+    for (size_t i = 1; i < end;) {
+        const auto tag = byte_type(bytes[i] >> 4);
+        const auto length = size_t(bytes[i] & 0x0f);
+        ++i;
+        if (i + length > end) {
+            // Ignore malformed trailing objects, the interface bytes are still valid.
+            return;
+        }
+        if (tag == COMPACT_TLV_CARD_CAPABILITIES_TAG && length == 3) {
+            const auto capabilities = bytes[i + 2];
+            info.hasCardCapabilities = true;
+            info.commandChainingSupported = capabilities & CAPABILITY_COMMAND_CHAINING;
+            info.extendedLengthSupported = capabilities & CAPABILITY_EXTENDED_LENGTH;
+        }
+        i += length;
+    }
+}
+
+} // namespace
+
+namespace pcsc_cpp
+{
+
+AtrInfo parseAtr(const byte_vector& atr)
+{
+    if (atr.size() < 2) {
+        THROW(Error, "parseAtr(): ATR is too short: "s + bytes2hexstr(atr));
+    }
+
+    AtrInfo info;
+
+    switch (atr[0]) {
+    case TS_DIRECT_CONVENTION:
+        info.convention = AtrInfo::Convention::DIRECT;
+        break;
+    case TS_INVERSE_CONVENTION:
+        info.convention = AtrInfo::Convention::INVERSE;
+        break;
+    default:
+        THROW(Error, "parseAtr(): Invalid TS byte in ATR: "s + bytes2hexstr(atr));
+    }
+
+    const size_t historicalBytesCount = atr[1] & 0x0f;
+    byte_type presence = atr[1] >> 4;
+    size_t pos = 2;
+    // Interface byte group number and the protocol that the group applies to, see 7816-3 8.2.3.
+    unsigned group = 1;
+    byte_type protocol = 0;
+    bool anyProtocol = false;
+    bool checkByteRequired = false;
+    bool t1ParametersSeen = false;
+
+    const auto next = [&atr, &pos]() {
+        if (pos >= atr.size()) {
+            THROW(Error, "parseAtr(): ATR is truncated: "s + bytes2hexstr(atr));
+        }
+        return atr[pos++];
+    };
+
+    while (true) {
+        const bool isFirstT1Group = group > 2 && protocol == 1 && !t1ParametersSeen;
+        if (isFirstT1Group) {
+            t1ParametersSeen = true;
+        }
+
+        if (presence & 0x1) {
+            const auto ta = next();
+            if (group == 1) {
+                info.fi = FI_TABLE[ta >> 4];
+                info.fMaxKHz = FMAX_KHZ_TABLE[ta >> 4];
+                info.di = DI_TABLE[ta & 0x0f];
+            } else if (group == 2) {
+                info.specificMode = true;
+                info.specificModeProtocol = ta & 0x0f;
+            } else if (isFirstT1Group) {
+                info.ifsc = ta;
+            }
+        }
+        if (presence & 0x2) {
+            const auto tb = next();
+            // TB1 and TB2 are deprecated.
+            if (isFirstT1Group) {
+                info.bwi = tb >> 4;
+                info.cwi = tb & 0x0f;
+            }
+        }
+        if (presence & 0x4) {
+            const auto tc = next();
+            if (group == 1) {
+                info.extraGuardTime = tc;
+            } else if (group == 2 && protocol == 0) {
+                info.waitingTimeInteger = tc;
+            } else if (isFirstT1Group) {
+                info.crcErrorDetection = tc & 0x01;
+            }
+        }
+        if (!(presence & 0x8)) {
+            break;
+        }
+
+        const auto td = next();
+        presence = td >> 4;
+        protocol = td & 0x0f;
+        ++group;
+
+        // T=15 qualifies global interface bytes and is not a protocol, but TCK is present
+        // whenever a TD byte indicates anything other than T=0, T=15 included.
+        if (protocol == 0) {
+            info.t0Supported = true;
+        } else if (protocol == 1) {
+            info.t1Supported = true;
+        }
+        anyProtocol |= protocol != 15;
+        checkByteRequired |= protocol != 0;
+    }
+
+    if (!anyProtocol) {
+        info.t0Supported = true;
+    }
+
+    if (pos + historicalBytesCount > atr.size()) {
+        THROW(Error, "parseAtr(): ATR is truncated: "s + bytes2hexstr(atr));
+    }
+    info.historicalBytes.assign(atr.cbegin() + std::ptrdiff_t(pos),
+                                atr.cbegin() + std::ptrdiff_t(pos + historicalBytesCount));
+    pos += historicalBytesCount;
+
+    // TCK is the XOR of all bytes from T0 to TCK inclusive, the result must be 0.
+    if (checkByteRequired) {
+        if (pos + 1 != atr.size()) {
+            THROW(Error, "parseAtr(): Invalid ATR length: "s + bytes2hexstr(atr));
+        }
+        byte_type checksum = 0;
+        for (auto i = size_t(1); i < atr.size(); ++i) {
+            checksum ^= atr[i];
+        }
+        if (checksum != 0) {
+            THROW(Error, "parseAtr(): Invalid ATR check byte: "s + bytes2hexstr(atr));
+        }
+    } else if (pos != atr.size()) {
+        THROW(Error, "parseAtr(): Invalid ATR length: "s + bytes2hexstr(atr));
+    }
+
+    parseHistoricalBytes(info);
+
+    return info;
+}
+
+} // namespace pcsc_cpp
@@ -23,6 +23,9 @@
 #include "pcsc-cpp/pcsc-cpp.hpp"
 #include "pcsc-cpp/pcsc-cpp-utils.hpp"
 
+#include <algorithm>
+#include <map>
+#include <mutex>
 #include <sstream>
 #include <iomanip>
 
@@ -67,6 +70,20 @@ public:
     }
 };
 
+
+// Best READ BINARY block lengths found by the adaptive readBinary(), by card ATR.
+std::mutex blockLengthCacheMutex;
+std::map<byte_vector, size_t> blockLengthCache;
+
+size_t initialBlockLength(const SmartCard& card)
+{
+    if (const auto cached = readBinaryBlockLength(card.atr())) {
+        return cached;
+    }
+    return card.extendedLengthSupported() ? CommandApdu::MAX_EXTENDED_LE
+                                          : ResponseApdu::MAX_DATA_SIZE;
+}
+
 } // namespace
 
 namespace pcsc_cpp
@@ -144,6 +161,11 @@ size_t readDataLengthFromAsn1(const SmartCard& card)
 
 byte_vector readBinary(const SmartCard& card, const size_t length, const size_t blockLength)
 {
+    if (blockLength == 0 || blockLength > CommandApdu::MAX_EXTENDED_LE) {
+        THROW(std::invalid_argument,
+              "readBinary(): Invalid block length: "s + std::to_string(blockLength));
+    }
+
     size_t blockLengthVar = blockLength;
     auto lengthCounter = length;
     auto resultBytes = byte_vector {};
@@ -158,10 +180,79 @@ byte_vector readBinary(const SmartCard& card, const size_t length, const size_t
 
         readBinary.p1 = HIBYTE(offset);
         readBinary.p2 = LOBYTE(offset);
-        readBinary.le = static_cast<byte_type>(blockLengthVar);
+        readBinary.le = static_cast<unsigned short>(blockLengthVar);
+
+        auto response = card.transmit(readBinary);
+
+        resultBytes.insert(resultBytes.end(), response.data.cbegin(), response.data.cend());
+    }
+
+    if (resultBytes.size() != length) {
+        // TODO: more specific exception
+        THROW(Error, "readBinary(): Invalid length: "s + std::to_string(resultBytes.size()));
+    }
+
+    return resultBytes;
+}
+
+size_t readBinaryBlockLength(const byte_vector& atr)
+{
+    std::lock_guard<std::mutex> lock(blockLengthCacheMutex);
+    const auto cached = blockLengthCache.find(atr);
+    return cached != blockLengthCache.cend() ? cached->second : 0;
+}
+
+void setReadBinaryBlockLength(const byte_vector& atr, const size_t blockLength)
+{
+    if (blockLength > CommandApdu::MAX_EXTENDED_LE) {
+        THROW(std::invalid_argument,
+              "setReadBinaryBlockLength(): Invalid block length: "s + std::to_string(blockLength));
+    }
+    std::lock_guard<std::mutex> lock(blockLengthCacheMutex);
+    if (blockLength == 0) {
+        blockLengthCache.erase(atr);
+    } else {
+        blockLengthCache[atr] = blockLength;
+    }
+}
+
+byte_vector readBinary(const SmartCard& card, const size_t length)
+{
+    const auto initialLength = initialBlockLength(card);
+    auto blockLength = initialLength;
+    auto resultBytes = byte_vector {};
+    resultBytes.reserve(length);
+    auto readBinary = CommandApdu {0x00, 0xb0, 0x00, 0x00};
+
+    while (resultBytes.size() < length) {
+        const auto offset = resultBytes.size();
+        const auto requestedLength = std::min(blockLength, length - offset);
+
+        readBinary.p1 = HIBYTE(offset);
+        readBinary.p2 = LOBYTE(offset);
+        readBinary.le = static_cast<unsigned short>(requestedLength);
 
         auto response = card.transmit(readBinary);
 
+        if (response.sw1 == ResponseApdu::WRONG_LENGTH && requestedLength > 1) {
+            // Fall back from extended to short length first, then halve the block length.
+            blockLength = requestedLength > ResponseApdu::MAX_DATA_SIZE
+                ? ResponseApdu::MAX_DATA_SIZE
+                : requestedLength / 2;
+            continue;
+        }
+        if (!response.isOK() || response.data.empty()) {
+            // TODO: more specific exception
+            THROW(Error,
+                  "readBinary(): Unexpected response at offset "s + std::to_string(offset) + ": "
+                      + bytes2hexstr(response.toBytes()));
+        }
+
+        // The card returns less than requested when Le was corrected after 0x6C.
+        if (response.data.size() < requestedLength) {
+            blockLength = response.data.size();
+        }
+
         resultBytes.insert(resultBytes.end(), response.data.cbegin(), response.data.cend());
     }
 
@@ -170,6 +261,10 @@ byte_vector readBinary(const SmartCard& card, const size_t length, const size_t
         THROW(Error, "readBinary(): Invalid length: "s + std::to_string(resultBytes.size()));
     }
 
+    if (blockLength != initialLength) {
+        setReadBinaryBlockLength(card.atr(), blockLength);
+    }
+
     return resultBytes;
 }
 
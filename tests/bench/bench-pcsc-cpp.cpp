@@ -0,0 +1,349 @@
+/*
+ * Copyright (c) 2020-2023 Estonian Information System Authority
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "pcsc-cpp/pcsc-cpp.hpp"
+#include "pcsc-cpp/pcsc-backend.hpp"
+
+#include "pcsc-mock/pcsc-mock.hpp"
+
+#include "ReaderStates.hpp"
+
+#include "allocation-counter.hpp"
+
+#include <benchmark/benchmark.h>
+
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <sstream>
+
+using namespace pcsc_cpp;
+
+namespace
+{
+
+#ifdef _WIN32
+const string_t EMULATED_READER_NAME = L"Emulated reader 0";
+#else
+const string_t EMULATED_READER_NAME = "Emulated reader 0";
+#endif
+
+constexpr size_t EMULATED_FILE_SIZE = 4096;
+
+const CommandApdu SELECT_EMULATED_FILE {0x00, 0xa4, 0x08, 0x0c, {0x50, 0x00, 0x50, 0x01}};
+
+byte_vector bytes(const size_t size)
+{
+    auto result = byte_vector(size);
+    for (size_t i = 0; i < size; ++i) {
+        result[i] = byte_type(i);
+    }
+    return result;
+}
+
+/** Measures allocations from construction until destruction and reports them per iteration. */
+class AllocationCounter
+{
+public:
+    explicit AllocationCounter(benchmark::State& s) :
+        state(s), start(allocationCount())
+    {
+    }
+
+    ~AllocationCounter()
+    {
+        const auto allocations = double(allocationCount() - start);
+        state.counters["allocs/op"] =
+            benchmark::Counter(allocations, benchmark::Counter::kAvgIterations);
+    }
+
+    PCSC_CPP_DISABLE_COPY_MOVE(AllocationCounter);
+
+private:
+    benchmark::State& state;
+    const size_t start;
+};
+
+/** Inserts a card with a 4 KiB transparent file 3F00/5000/5001 into the emulator. */
+SmartCard::ptr connectToEmulatedCard()
+{
+    auto card = EmulatedCard {};
+    card.extendedLengthSupported = true;
+    card.masterFile = EmulatedFile::dedicated(
+        0x3f00,
+        {EmulatedFile::dedicated(
+            0x5000, {EmulatedFile::elementary(0x5001, bytes(EMULATED_FILE_SIZE))})});
+    insertEmulatedCard(EMULATED_READER_NAME, card);
+
+    auto result = listReaders(establishContext(emulatedPcscBackend())).at(0).connectToCard();
+    result->setExtendedLengthSupported(true);
+    return result;
+}
+
+// APDU serialization.
+
+void BM_CommandApduToBytes(benchmark::State& state)
+{
+    const auto command = CommandApdu {0x00, 0xd6, 0x00, 0x00, bytes(size_t(state.range(0))), 0};
+    AllocationCounter counter(state);
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(command.toBytes());
+    }
+}
+BENCHMARK(BM_CommandApduToBytes)->Arg(16)->Arg(255);
+
+void BM_CommandApduToBytesReusedBuffer(benchmark::State& state)
+{
+    const auto command = CommandApdu {0x00, 0xd6, 0x00, 0x00, bytes(size_t(state.range(0))), 0};
+    auto buffer = byte_vector {};
+    command.toBytes(buffer);
+    AllocationCounter counter(state);
+    for (auto _ : state) {
+        command.toBytes(buffer);
+        benchmark::DoNotOptimize(buffer.data());
+    }
+}
+BENCHMARK(BM_CommandApduToBytesReusedBuffer)->Arg(16)->Arg(255);
+
+void BM_CommandApduFromBytes(benchmark::State& state)
+{
+    const auto commandBytes =
+        CommandApdu {0x00, 0xd6, 0x00, 0x00, bytes(size_t(state.range(0))), 0}.toBytes();
+    AllocationCounter counter(state);
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(CommandApdu::fromBytes(commandBytes));
+    }
+}
+BENCHMARK(BM_CommandApduFromBytes)->Arg(16)->Arg(255);
+
+void BM_ResponseApduFromBytes(benchmark::State& state)
+{
+    auto responseBytes = bytes(size_t(state.range(0)));
+    responseBytes.insert(responseBytes.end(), {0x90, 0x00});
+    AllocationCounter counter(state);
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(ResponseApdu::fromBytes(responseBytes));
+    }
+}
+BENCHMARK(BM_ResponseApduFromBytes)->Arg(0)->Arg(256);
+
+void BM_ResponseApduToBytes(benchmark::State& state)
+{
+    const auto response = ResponseApdu {0x90, 0x00, bytes(size_t(state.range(0)))};
+    AllocationCounter counter(state);
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(response.toBytes());
+    }
+}
+BENCHMARK(BM_ResponseApduToBytes)->Arg(0)->Arg(256);
+
+// Utilities.
+
+void BM_Bytes2HexStr(benchmark::State& state)
+{
+    const auto input = bytes(size_t(state.range(0)));
+    AllocationCounter counter(state);
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(bytes2hexstr(input));
+    }
+    state.SetBytesProcessed(int64_t(state.iterations()) * state.range(0));
+}
+BENCHMARK(BM_Bytes2HexStr)->Arg(16)->Arg(256);
+
+void BM_FlagSetFromReaderState(benchmark::State& state)
+{
+    const auto readerState = DWORD(SCARD_STATE_CHANGED | SCARD_STATE_PRESENT | SCARD_STATE_INUSE);
+    AllocationCounter counter(state);
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(flagSetFromReaderState(readerState));
+    }
+}
+BENCHMARK(BM_FlagSetFromReaderState);
+
+void BM_ReaderStatusString(benchmark::State& state)
+{
+    auto status = flag_set<Reader::Status> {Reader::Status::PRESENT};
+    status.set(Reader::Status::CHANGED);
+    status.set(Reader::Status::INUSE);
+    const auto reader = Reader {nullptr, EMULATED_READER_NAME, {}, status};
+    AllocationCounter counter(state);
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(reader.statusString());
+    }
+}
+BENCHMARK(BM_ReaderStatusString);
+
+// Card communication.
+
+void BM_TransmitMock(benchmark::State& state)
+{
+    PcscMock::reset();
+    const auto card = listReaders().at(0).connectToCard();
+    const auto command = CommandApdu::fromBytes(PcscMock::DEFAULT_COMMAND_APDU);
+    auto transactionGuard = card->beginTransaction();
+    AllocationCounter counter(state);
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(card->transmit(command));
+    }
+}
+BENCHMARK(BM_TransmitMock);
+
+void BM_TransmitEmulator(benchmark::State& state)
+{
+    const auto card = connectToEmulatedCard();
+    {
+        auto transactionGuard = card->beginTransaction();
+        AllocationCounter counter(state);
+        for (auto _ : state) {
+            benchmark::DoNotOptimize(card->transmit(SELECT_EMULATED_FILE));
+        }
+    }
+    removeEmulatedReaders();
+}
+BENCHMARK(BM_TransmitEmulator);
+
+void BM_TransmitEmulatorReusedBuffer(benchmark::State& state)
+{
+    const auto card = connectToEmulatedCard();
+    {
+        const auto commandBytes = SELECT_EMULATED_FILE.toBytes();
+        auto responseBuffer = byte_vector(ResponseApdu::MAX_SIZE);
+        auto transactionGuard = card->beginTransaction();
+        AllocationCounter counter(state);
+        for (auto _ : state) {
+            benchmark::DoNotOptimize(card->transmit(commandBytes, responseBuffer));
+        }
+    }
+    removeEmulatedReaders();
+}
+BENCHMARK(BM_TransmitEmulatorReusedBuffer);
+
+void BM_ReadBinaryEmulator(benchmark::State& state)
+{
+    const auto card = connectToEmulatedCard();
+    {
+        auto transactionGuard = card->beginTransaction();
+        card->transmit(SELECT_EMULATED_FILE);
+        const auto blockLength = size_t(state.range(0));
+        AllocationCounter counter(state);
+        for (auto _ : state) {
+            benchmark::DoNotOptimize(readBinary(*card, EMULATED_FILE_SIZE, blockLength));
+        }
+        state.SetBytesProcessed(int64_t(state.iterations() * EMULATED_FILE_SIZE));
+    }
+    removeEmulatedReaders();
+}
+BENCHMARK(BM_ReadBinaryEmulator)->Arg(0xdf)->Arg(0xff)->Arg(0x1000);
+
+// Regression check against the allocation baseline.
+
+/** Console reporter that additionally collects allocations per operation of every run. */
+class AllocationCollectingReporter : public benchmark::ConsoleReporter
+{
+public:
+    void ReportRuns(const std::vector<Run>& runs) override
+    {
+        for (const auto& run : runs) {
+            const auto allocations = run.counters.find("allocs/op");
+            if (!run.error_occurred && allocations != run.counters.cend()) {
+                allocationsPerOperation[run.benchmark_name()] = allocations->second.value;
+            }
+        }
+        ConsoleReporter::ReportRuns(runs);
+    }
+
+    std::map<std::string, double> allocationsPerOperation;
+};
+
+/**
+ * Compare measured allocations with the baseline file that has a "<benchmark name> <allocs/op>"
+ * line per benchmark. A benchmark regresses when it allocates more than 1.5 times its baseline
+ * or at least one more allocation, whichever is larger. Returns the number of regressions.
+ */
+int checkAllocationBaseline(const std::string& baselineFile,
+                            const std::map<std::string, double>& measured)
+{
+    std::ifstream baseline(baselineFile);
+    if (!baseline) {
+        std::cerr << "Cannot open allocation baseline " << baselineFile << '\n';
+        return 1;
+    }
+
+    auto regressions = 0;
+    std::string line;
+    while (std::getline(baseline, line)) {
+        if (line.empty() || line[0] == '#') {
+            continue;
+        }
+        std::istringstream fields(line);
+        auto name = std::string {};
+        auto expected = 0.0;
+        if (!(fields >> name >> expected)) {
+            std::cerr << "Invalid allocation baseline line: " << line << '\n';
+            ++regressions;
+            continue;
+        }
+        const auto actual = measured.find(name);
+        if (actual == measured.cend()) {
+            continue;
+        }
+        if (actual->second > std::max(expected * 1.5, expected + 1.0)) {
+            std::cerr << "Allocation regression in " << name << ": " << actual->second
+                      << " allocs/op, baseline " << expected << '\n';
+            ++regressions;
+        }
+    }
+    return regressions;
+}
+
+} // namespace
+
+int main(int argc, char** argv)
+{
+    constexpr auto BASELINE_FLAG = "--allocation_baseline=";
+    auto baselineFile = std::string {};
+    auto benchmarkArgc = 0;
+    for (auto i = 0; i < argc; ++i) {
+        if (std::strncmp(argv[i], BASELINE_FLAG, std::strlen(BASELINE_FLAG)) == 0) {
+            baselineFile = argv[i] + std::strlen(BASELINE_FLAG);
+        } else {
+            argv[benchmarkArgc++] = argv[i];
+        }
+    }
+
+    benchmark::Initialize(&benchmarkArgc, argv);
+    if (benchmark::ReportUnrecognizedArguments(benchmarkArgc, argv)) {
+        return 1;
+    }
+
+    if (baselineFile.empty()) {
+        benchmark::RunSpecifiedBenchmarks();
+        benchmark::Shutdown();
+        return 0;
+    }
+
+    AllocationCollectingReporter reporter;
+    benchmark::RunSpecifiedBenchmarks(&reporter);
+    benchmark::Shutdown();
+    return checkAllocationBaseline(baselineFile, reporter.allocationsPerOperation) ? 1 : 0;
+}
@@ -0,0 +1,84 @@
+/*
+ * Copyright (c) 2020-2023 Estonian Information System Authority
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "pcsc-cpp/pcsc-cpp.hpp"
+
+#include <gtest/gtest.h>
+
+using namespace pcsc_cpp;
+
+TEST(pcsc_cpp_test, apduByteVectorKeepsShortDataInline)
+{
+    auto data = apdu_byte_vector {0x01, 0x02};
+    data.insert(data.end(), {0x03, 0x04});
+    data.push_back(0x05);
+
+    EXPECT_EQ(data.capacity(), SHORT_APDU_MAX_SIZE);
+    EXPECT_EQ(data, (byte_vector {0x01, 0x02, 0x03, 0x04, 0x05}));
+
+    auto full = apdu_byte_vector(SHORT_APDU_MAX_SIZE, 0xaa);
+    EXPECT_EQ(full.capacity(), SHORT_APDU_MAX_SIZE);
+}
+
+TEST(pcsc_cpp_test, apduByteVectorSpillsExtendedDataToHeap)
+{
+    auto data = apdu_byte_vector(SHORT_APDU_MAX_SIZE, 0xaa);
+    data.push_back(0xbb);
+
+    EXPECT_GT(data.capacity(), SHORT_APDU_MAX_SIZE);
+    EXPECT_EQ(data.size(), SHORT_APDU_MAX_SIZE + 1);
+    EXPECT_EQ(data.front(), 0xaa);
+    EXPECT_EQ(data.back(), 0xbb);
+
+    auto moved = std::move(data);
+    EXPECT_EQ(moved.size(), SHORT_APDU_MAX_SIZE + 1);
+    EXPECT_TRUE(data.empty());
+
+    // Insert from own storage while growing.
+    moved.insert(moved.begin(), moved.cbegin(), moved.cbegin() + 2);
+    EXPECT_EQ(moved[0], 0xaa);
+    EXPECT_EQ(moved.size(), SHORT_APDU_MAX_SIZE + 3);
+}
+
+TEST(pcsc_cpp_test, apduByteVectorInsertsFromOwnStorageInPlace)
+{
+    auto data = apdu_byte_vector {0x01, 0x02, 0x03, 0x04, 0x05};
+
+    // Source before and overlapping the insertion point.
+    data.insert(data.cbegin() + 1, data.cbegin(), data.cbegin() + 3);
+    EXPECT_EQ(data, (apdu_byte_vector {0x01, 0x01, 0x02, 0x03, 0x02, 0x03, 0x04, 0x05}));
+
+    // Source in the tail that is moved.
+    data.insert(data.cbegin() + 1, data.cend() - 2, data.cend());
+    EXPECT_EQ(data,
+              (apdu_byte_vector {0x01, 0x04, 0x05, 0x01, 0x02, 0x03, 0x02, 0x03, 0x04, 0x05}));
+}
+
+TEST(pcsc_cpp_test, apduByteVectorConvertsToAndFromByteVector)
+{
+    const auto bytes = byte_vector {0x90, 0x00};
+    const apdu_byte_vector data = bytes;
+    const byte_vector copy = data;
+
+    EXPECT_EQ(copy, bytes);
+    EXPECT_EQ(bytes2hexstr(data), "9000");
+}
@@ -0,0 +1,85 @@
+/*
+ * Copyright (c) 2020-2023 Estonian Information System Authority
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "pcsc-cpp/pcsc-cpp.hpp"
+
+#include "pcsc-mock/pcsc-mock.hpp"
+
+#include <gtest/gtest.h>
+
+using namespace pcsc_cpp;
+
+namespace
+{
+
+const byte_vector SEGMENT_RESPONSE_OK {0x90, 0x00};
+
+byte_vector segment(byte_type cla, const byte_vector& data)
+{
+    auto bytes = byte_vector(5 + data.size());
+    bytes[0] = cla;
+    bytes[1] = 0x2a;
+    bytes[2] = 0x9e;
+    bytes[3] = 0x9a;
+    bytes[4] = byte_type(data.size());
+    std::copy(data.cbegin(), data.cend(), bytes.begin() + 5);
+    return bytes;
+}
+
+} // namespace
+
+TEST(pcsc_cpp_test, transmitLongCommandUsesChaining)
+{
+    const auto data = byte_vector(300, 0x11);
+
+    PcscMock::setApduScript({
+        {segment(0x10, byte_vector(255, 0x11)), SEGMENT_RESPONSE_OK},
+        {segment(0x00, byte_vector(45, 0x11)), {0x01, 0x02, 0x90, 0x00}},
+    });
+
+    auto card = listReaders()[0].connectToCard();
+    auto transactionGuard = card->beginTransaction();
+    auto response = card->transmit(CommandApdu {0x00, 0x2a, 0x9e, 0x9a, data});
+
+    EXPECT_TRUE(response.isOK());
+    EXPECT_EQ(response.data, (byte_vector {0x01, 0x02}));
+
+    PcscMock::reset();
+}
+
+TEST(pcsc_cpp_test, transmitLongCommandStopsChainingOnError)
+{
+    const auto data = byte_vector(600, 0x22);
+
+    PcscMock::setApduScript({
+        {segment(0x10, byte_vector(255, 0x22)), SEGMENT_RESPONSE_OK},
+        {segment(0x10, byte_vector(255, 0x22)), {0x6a, 0x80}},
+    });
+
+    auto card = listReaders()[0].connectToCard();
+    auto transactionGuard = card->beginTransaction();
+    auto response = card->transmit(CommandApdu {0x00, 0x2a, 0x9e, 0x9a, data});
+
+    EXPECT_EQ(response.toSW(), 0x6a80);
+
+    PcscMock::reset();
+}
@@ -0,0 +1,107 @@
+/*
+ * Copyright (c) 2020-2023 Estonian Information System Authority
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "pcsc-cpp/pcsc-cpp.hpp"
+
+#include "pcsc-mock/pcsc-mock.hpp"
+
+#include <gtest/gtest.h>
+
+using namespace pcsc_cpp;
+
+TEST(pcsc_cpp_test, shortCommandApduToBytesAndFromBytes)
+{
+    const auto command = CommandApdu {0x00, 0xb0, 0x00, 0x00, byte_vector(), 256};
+
+    EXPECT_FALSE(command.isExtended());
+    EXPECT_EQ(command.toBytes(), (byte_vector {0x00, 0xb0, 0x00, 0x00, 0x00}));
+
+    const auto select = CommandApdu::fromBytes({0x00, 0xa4, 0x01, 0x0c, 0x02, 0xee, 0xee});
+    EXPECT_EQ(select.data, (byte_vector {0xee, 0xee}));
+    EXPECT_FALSE(select.isLeSet());
+}
+
+TEST(pcsc_cpp_test, extendedCommandApduToBytesAndFromBytes)
+{
+    const auto readBinary = CommandApdu {0x00, 0xb0, 0x00, 0x00, byte_vector(), 0x0f00};
+
+    EXPECT_TRUE(readBinary.isExtended());
+    EXPECT_EQ(readBinary.responseBufferSize(), 0x0f02U);
+    EXPECT_EQ(readBinary.toBytes(), (byte_vector {0x00, 0xb0, 0x00, 0x00, 0x00, 0x0f, 0x00}));
+
+    const auto parsedReadBinary = CommandApdu::fromBytes(readBinary.toBytes(), true);
+    EXPECT_EQ(parsedReadBinary.le, 0x0f00);
+    EXPECT_TRUE(parsedReadBinary.data.empty());
+
+    const auto update = CommandApdu {0x00, 0xd6, 0x00, 0x00, byte_vector(300, 0xab), 0};
+    const auto updateBytes = update.toBytes();
+
+    ASSERT_EQ(updateBytes.size(), 4U + 3U + 300U + 2U);
+    EXPECT_EQ(updateBytes[4], 0x00);
+    EXPECT_EQ(updateBytes[5], 0x01);
+    EXPECT_EQ(updateBytes[6], 0x2c);
+    EXPECT_EQ(update.responseBufferSize(), ResponseApdu::MAX_EXTENDED_SIZE);
+
+    const auto parsedUpdate = CommandApdu::fromBytes(updateBytes, true);
+    EXPECT_EQ(parsedUpdate.data, update.data);
+    EXPECT_EQ(parsedUpdate.le, 0);
+}
+
+TEST(pcsc_cpp_test, extendedCommandApduWithMaximumLe)
+{
+    const auto readBinary = CommandApdu {0x00, 0xb0, 0x00, 0x00, byte_vector(), 0xffff};
+
+    ASSERT_TRUE(readBinary.isLeSet());
+    EXPECT_TRUE(readBinary.isExtended());
+    EXPECT_EQ(readBinary.responseBufferSize(), 0xffffU + 2U);
+    EXPECT_EQ(readBinary.toBytes(), (byte_vector {0x00, 0xb0, 0x00, 0x00, 0x00, 0xff, 0xff}));
+    EXPECT_EQ(CommandApdu::fromBytes(readBinary.toBytes(), true).le, 0xffff);
+
+    const auto withoutLe = CommandApdu {0x00, 0xb0, 0x00, 0x00};
+    EXPECT_FALSE(withoutLe.isLeSet());
+    EXPECT_EQ(withoutLe.toBytes(), (byte_vector {0x00, 0xb0, 0x00, 0x00}));
+}
+
+TEST(pcsc_cpp_test, extendedCommandApduTooLongDataThrows)
+{
+    const auto command = CommandApdu {0x00, 0xd6, 0x00, 0x00, byte_vector(65536, 0)};
+
+    EXPECT_THROW(command.toBytes(), std::invalid_argument);
+}
+
+TEST(pcsc_cpp_test, transmitExtendedLengthApduSuccess)
+{
+    auto responseBytes = byte_vector(1000, 0x42);
+    responseBytes.push_back(0x90);
+    responseBytes.push_back(0x00);
+
+    PcscMock::setApduScript({{{0x00, 0xb0, 0x00, 0x00, 0x00, 0x03, 0xe8}, responseBytes}});
+
+    auto card = listReaders()[0].connectToCard();
+    auto transactionGuard = card->beginTransaction();
+    auto response = card->transmit(CommandApdu {0x00, 0xb0, 0x00, 0x00, byte_vector(), 1000});
+
+    EXPECT_TRUE(response.isOK());
+    EXPECT_EQ(response.data, byte_vector(1000, 0x42));
+
+    PcscMock::reset();
+}
@@ -0,0 +1,138 @@
+/*
+ * Copyright (c) 2020-2023 Estonian Information System Authority
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "pcsc-cpp/pcsc-cpp.hpp"
+
+#include "pcsc-mock/pcsc-mock.hpp"
+#include "pcsc-cpp/comp_winscard.hpp"
+
+#include <gtest/gtest.h>
+
+#include <cstdio>
+
+using namespace pcsc_cpp;
+
+namespace
+{
+
+ApduSession recordDefaultCommand()
+{
+    auto card = listReaders()[0].connectToCard();
+    auto transactionGuard = card->beginTransaction();
+    card->startSessionRecording();
+    card->transmit(CommandApdu::fromBytes(PcscMock::DEFAULT_COMMAND_APDU));
+    return card->stopSessionRecording();
+}
+
+} // namespace
+
+TEST(pcsc_cpp_test, apduSessionRecordsTransmits)
+{
+    const auto session = recordDefaultCommand();
+
+    EXPECT_EQ(session.reader, listReaders()[0].name);
+    EXPECT_EQ(session.atr, PcscMock::DEFAULT_CARD_ATR);
+    ASSERT_EQ(session.exchanges.size(), 1U);
+    const auto& exchange = session.exchanges[0];
+    EXPECT_EQ(exchange.kind, ApduSession::Exchange::Kind::TRANSMIT);
+    EXPECT_EQ(exchange.result, uint32_t(SCARD_S_SUCCESS));
+    EXPECT_EQ(exchange.command, PcscMock::DEFAULT_COMMAND_APDU);
+    EXPECT_EQ(exchange.response, PcscMock::DEFAULT_RESPONSE_APDU);
+}
+
+TEST(pcsc_cpp_test, apduSessionSerializationRoundTrips)
+{
+    auto session = recordDefaultCommand();
+    ApduSession::Exchange control;
+    control.kind = ApduSession::Exchange::Kind::CONTROL;
+    control.controlCode = 0x42000d48;
+    control.result = uint32_t(SCARD_E_TIMEOUT);
+    control.start = session.exchanges[0].start + std::chrono::microseconds(300);
+    control.duration = std::chrono::seconds(30);
+    control.command = {0x00, 0x20, 0x00, 0x01};
+    session.exchanges.push_back(control);
+
+    const auto restored = ApduSession::deserialize(session.serialize());
+
+    EXPECT_EQ(restored.reader, session.reader);
+    EXPECT_EQ(restored.atr, session.atr);
+    EXPECT_EQ(restored.protocol, session.protocol);
+    EXPECT_EQ(restored.readerFeatures, session.readerFeatures);
+    ASSERT_EQ(restored.exchanges.size(), 2U);
+    for (size_t i = 0; i < restored.exchanges.size(); ++i) {
+        EXPECT_EQ(restored.exchanges[i].kind, session.exchanges[i].kind);
+        EXPECT_EQ(restored.exchanges[i].controlCode, session.exchanges[i].controlCode);
+        EXPECT_EQ(restored.exchanges[i].result, session.exchanges[i].result);
+        EXPECT_EQ(restored.exchanges[i].start, session.exchanges[i].start);
+        EXPECT_EQ(restored.exchanges[i].duration, session.exchanges[i].duration);
+        EXPECT_EQ(restored.exchanges[i].command, session.exchanges[i].command);
+        EXPECT_EQ(restored.exchanges[i].response, session.exchanges[i].response);
+    }
+
+    const auto path = testing::TempDir() + "pcsc-cpp-test-apdu-session";
+    session.save(path);
+    EXPECT_EQ(ApduSession::load(path).serialize(), session.serialize());
+    std::remove(path.c_str());
+}
+
+TEST(pcsc_cpp_test, apduSessionDeserializeRejectsInvalidData)
+{
+    EXPECT_THROW(ApduSession::deserialize({0x01, 0x02}), Error);
+
+    auto data = recordDefaultCommand().serialize();
+    data.pop_back();
+    EXPECT_THROW(ApduSession::deserialize(data), Error);
+}
+
+TEST(pcsc_cpp_test, apduSessionReplayServesRecordedResponses)
+{
+    auto card = SmartCard {recordDefaultCommand()};
+    EXPECT_EQ(card.atr(), PcscMock::DEFAULT_CARD_ATR);
+
+    auto transactionGuard = card.beginTransaction();
+    const auto response = card.transmit(CommandApdu::fromBytes(PcscMock::DEFAULT_COMMAND_APDU));
+    EXPECT_EQ(response.toBytes(), PcscMock::DEFAULT_RESPONSE_APDU);
+
+    // The session has been used up.
+    EXPECT_THROW(card.transmit(CommandApdu::fromBytes(PcscMock::DEFAULT_COMMAND_APDU)), Error);
+}
+
+TEST(pcsc_cpp_test, apduSessionReplayRejectsDifferentCommand)
+{
+    auto card = SmartCard {recordDefaultCommand()};
+    auto transactionGuard = card.beginTransaction();
+
+    EXPECT_THROW(card.transmit(CommandApdu {0x00, 0xb0, 0x00, 0x00}), Error);
+}
+
+TEST(pcsc_cpp_test, apduSessionReplayThrowsRecordedErrors)
+{
+    auto session = recordDefaultCommand();
+    session.exchanges[0].result = uint32_t(SCARD_E_NOT_READY);
+    session.exchanges[0].response.clear();
+
+    auto card = SmartCard {session, SmartCard::ReplayPace::RECORDED};
+    auto transactionGuard = card.beginTransaction();
+
+    EXPECT_THROW(card.transmit(CommandApdu::fromBytes(PcscMock::DEFAULT_COMMAND_APDU)),
+                 ScardCardCommunicationFailedError);
+}
@@ -0,0 +1,340 @@
+/*
+ * Copyright (c) 2020-2023 Estonian Information System Authority
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "pcsc-cpp/pcsc-cpp.hpp"
+#include "pcsc-cpp/pcsc-backend.hpp"
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <future>
+#include <mutex>
+#include <thread>
+
+using namespace pcsc_cpp;
+
+namespace
+{
+
+#ifdef _WIN32
+const string_t READER_NAME = L"Emulated reader 0";
+#else
+const string_t READER_NAME = "Emulated reader 0";
+#endif
+
+const byte_vector AID {0xa0, 0x00, 0x00, 0x00, 0x77, 0x01};
+
+byte_vector fileContent(const size_t size)
+{
+    auto content = byte_vector(size);
+    for (size_t i = 0; i < size; ++i) {
+        content[i] = byte_type(i);
+    }
+    return content;
+}
+
+EmulatedCard emulatedCard(const SmartCard::Protocol protocol)
+{
+    auto card = EmulatedCard {};
+    card.protocol = protocol;
+    card.masterFile = EmulatedFile::dedicated(
+        0x3f00,
+        {EmulatedFile::dedicated(0x5000, {EmulatedFile::elementary(0x5001, fileContent(600))},
+                                 AID)});
+    return card;
+}
+
+class CardEmulatorTest : public testing::Test
+{
+protected:
+    void TearDown() override { removeEmulatedReaders(); }
+
+    SmartCard::ptr connect(const SmartCard::Protocol protocol)
+    {
+        insertEmulatedCard(READER_NAME, emulatedCard(protocol));
+        const auto readers = listReaders(establishContext(emulatedPcscBackend()));
+        EXPECT_EQ(readers.size(), 1U);
+        return readers.at(0).connectToCard();
+    }
+};
+
+void selectFileAndReadBinary(SmartCard& card)
+{
+    auto transactionGuard = card.beginTransaction();
+
+    // SELECT by DF name with FCP, T=0 cards return it with GET RESPONSE.
+    const auto df = card.transmit({0x00, 0xa4, 0x04, 0x04, AID, 0x00});
+    ASSERT_TRUE(df.isOK());
+    ASSERT_FALSE(df.data.empty());
+    EXPECT_EQ(df.data[0], 0x62);
+
+    EXPECT_TRUE(card.transmit({0x00, 0xa4, 0x02, 0x0c, {0x50, 0x01}}).isOK());
+    EXPECT_EQ(readBinary(card, 600, 0xff), fileContent(600));
+}
+
+} // namespace
+
+TEST_F(CardEmulatorTest, listReadersReportsEmulatedCard)
+{
+    insertEmulatedCard(READER_NAME, emulatedCard(SmartCard::Protocol::T1));
+
+    const auto readers = listReaders(establishContext(emulatedPcscBackend()));
+    ASSERT_EQ(readers.size(), 1U);
+    EXPECT_EQ(readers[0].name, READER_NAME);
+    EXPECT_TRUE(readers[0].isCardInserted());
+    EXPECT_EQ(readers[0].cardAtr, EmulatedCard {}.atr);
+
+    removeEmulatedCard(READER_NAME);
+    EXPECT_FALSE(listReaders(establishContext(emulatedPcscBackend()))[0].isCardInserted());
+}
+
+TEST_F(CardEmulatorTest, selectAndReadBinaryWithT1)
+{
+    auto card = connect(SmartCard::Protocol::T1);
+    EXPECT_EQ(card->protocol(), SmartCard::Protocol::T1);
+    selectFileAndReadBinary(*card);
+}
+
+TEST_F(CardEmulatorTest, selectAndReadBinaryWithT0)
+{
+    auto card = connect(SmartCard::Protocol::T0);
+    EXPECT_EQ(card->protocol(), SmartCard::Protocol::T0);
+    selectFileAndReadBinary(*card);
+
+    // Le beyond the end of file, the card reports the available length with 6Cxx.
+    auto transactionGuard = card->beginTransaction();
+    const auto tail = card->transmit({0x00, 0xb0, 0x02, 0x00, {}, 0x80});
+    EXPECT_TRUE(tail.isOK());
+    EXPECT_EQ(tail.data.size(), 600U - 0x200);
+}
+
+TEST_F(CardEmulatorTest, updateBinaryChangesFileContent)
+{
+    auto card = connect(SmartCard::Protocol::T1);
+    auto transactionGuard = card->beginTransaction();
+
+    // SELECT by path from MF, UPDATE BINARY and READ BINARY.
+    EXPECT_TRUE(card->transmit({0x00, 0xa4, 0x08, 0x0c, {0x50, 0x00, 0x50, 0x01}}).isOK());
+    EXPECT_TRUE(card->transmit({0x00, 0xd6, 0x00, 0x10, {0xaa, 0xbb}}).isOK());
+    EXPECT_EQ(card->transmit({0x00, 0xb0, 0x00, 0x10, {}, 0x02}).data,
+              apdu_byte_vector({0xaa, 0xbb}));
+
+    EXPECT_EQ(card->transmit({0x00, 0xd6, 0x02, 0x57, {0x01, 0x02}}).toSW(), 0x6a84);
+    EXPECT_EQ(card->transmit({0x00, 0xa4, 0x00, 0x0c, {0x12, 0x34}}).toSW(), 0x6a82);
+}
+
+TEST_F(CardEmulatorTest, extendedLengthNeedsSupport)
+{
+    const auto extendedRead = CommandApdu {0x00, 0xb0, 0x00, 0x00, {}, 600};
+    {
+        auto card = connect(SmartCard::Protocol::T1);
+        auto transactionGuard = card->beginTransaction();
+        EXPECT_TRUE(card->transmit({0x00, 0xa4, 0x08, 0x0c, {0x50, 0x00, 0x50, 0x01}}).isOK());
+        EXPECT_EQ(card->transmit(extendedRead).toSW(), 0x6700);
+    }
+
+    removeEmulatedReaders();
+    auto extendedCard = emulatedCard(SmartCard::Protocol::T1);
+    extendedCard.extendedLengthSupported = true;
+    insertEmulatedCard(READER_NAME, extendedCard);
+    auto card = listReaders(establishContext(emulatedPcscBackend()))[0].connectToCard();
+    card->setExtendedLengthSupported(true);
+
+    auto guard = card->beginTransaction();
+    EXPECT_TRUE(card->transmit({0x00, 0xa4, 0x08, 0x0c, {0x50, 0x00, 0x50, 0x01}}).isOK());
+    EXPECT_EQ(card->transmit(extendedRead).data.size(), 600U);
+}
+
+TEST_F(CardEmulatorTest, removedCardDisconnects)
+{
+    auto card = connect(SmartCard::Protocol::T1);
+    EXPECT_TRUE(card->isConnected());
+
+    removeEmulatedCard(READER_NAME);
+
+    EXPECT_FALSE(card->isConnected());
+    EXPECT_THROW(card->beginTransaction(), ScardCardRemovedError);
+}
+
+TEST_F(CardEmulatorTest, latencyModelDelaysApdus)
+{
+    auto slowCard = emulatedCard(SmartCard::Protocol::T1);
+    slowCard.baudRate = 9600;
+    slowCard.apduOverhead = std::chrono::milliseconds(5);
+    insertEmulatedCard(READER_NAME, slowCard);
+    auto card = listReaders(establishContext(emulatedPcscBackend()))[0].connectToCard();
+    auto transactionGuard = card->beginTransaction();
+
+    const auto start = std::chrono::steady_clock::now();
+    card->transmit({0x00, 0xa4, 0x00, 0x0c, {0x3f, 0x00}});
+    // 5 ms overhead and 9 bytes of 11 bits at 9600 bit/s.
+    EXPECT_GE(std::chrono::steady_clock::now() - start, std::chrono::microseconds(5000 + 10312));
+}
+
+TEST_F(CardEmulatorTest, transactionHoldIsNotBlockedByWaitingTransaction)
+{
+    using namespace std::chrono_literals;
+
+    auto owner = connect(SmartCard::Protocol::T1);
+    auto card = listReaders(establishContext(emulatedPcscBackend()))[0].connectToCard();
+    card->setTransactionHold(50ms, 1s);
+
+    auto waiting = std::thread {};
+    auto holdChanged = std::future<void> {};
+    {
+        auto ownerGuard = owner->beginTransaction();
+        waiting = std::thread([&card] { auto transactionGuard = card->beginTransaction(); });
+        // Let the thread block in SCardBeginTransaction() until the owner ends its transaction.
+        std::this_thread::sleep_for(100ms);
+
+        holdChanged =
+            std::async(std::launch::async, [&card] { card->setTransactionHold(0ms, 0ms); });
+        EXPECT_EQ(holdChanged.wait_for(2s), std::future_status::ready);
+    }
+    waiting.join();
+}
+
+TEST_F(CardEmulatorTest, defaultBackendIsUsedForNewContexts)
+{
+    insertEmulatedCard(READER_NAME, emulatedCard(SmartCard::Protocol::T1));
+
+    setDefaultPcscBackend(emulatedPcscBackend());
+    const auto readers = listReaders();
+    setDefaultPcscBackend(systemPcscBackend());
+
+    ASSERT_EQ(readers.size(), 1U);
+    EXPECT_EQ(readers[0].name, READER_NAME);
+}
+
+TEST_F(CardEmulatorTest, readerMonitorReportsEmulatedCardInsertion)
+{
+    std::mutex mutex;
+    std::condition_variable eventReceived;
+    std::vector<ReaderMonitor::Event> events;
+
+    setDefaultPcscBackend(emulatedPcscBackend());
+    insertEmulatedCard(READER_NAME, emulatedCard(SmartCard::Protocol::T1));
+    removeEmulatedCard(READER_NAME);
+    {
+        const auto monitor = ReaderMonitor {[&](const ReaderMonitor::Event event, const Reader&) {
+            std::lock_guard<std::mutex> lock(mutex);
+            events.push_back(event);
+            eventReceived.notify_one();
+        }};
+        insertEmulatedCard(READER_NAME, emulatedCard(SmartCard::Protocol::T1));
+
+        std::unique_lock<std::mutex> lock(mutex);
+        eventReceived.wait_for(lock, std::chrono::seconds(5), [&] {
+            return std::find(events.cbegin(), events.cend(), ReaderMonitor::Event::CARD_INSERTED)
+                != events.cend();
+        });
+    }
+    setDefaultPcscBackend(systemPcscBackend());
+
+    EXPECT_NE(std::find(events.cbegin(), events.cend(), ReaderMonitor::Event::CARD_INSERTED),
+              events.cend());
+}
+
+TEST_F(CardEmulatorTest, readerMonitorReportsEmulatedReaderAttach)
+{
+    std::mutex mutex;
+    std::condition_variable eventReceived;
+    std::vector<ReaderMonitor::Event> events;
+
+    setDefaultPcscBackend(emulatedPcscBackend());
+    {
+        const auto monitor = ReaderMonitor {[&](const ReaderMonitor::Event event, const Reader&) {
+            std::lock_guard<std::mutex> lock(mutex);
+            events.push_back(event);
+            eventReceived.notify_one();
+        }};
+        insertEmulatedCard(READER_NAME, emulatedCard(SmartCard::Protocol::T1));
+
+        std::unique_lock<std::mutex> lock(mutex);
+        eventReceived.wait_for(lock, std::chrono::seconds(5), [&] {
+            return std::find(events.cbegin(), events.cend(), ReaderMonitor::Event::READER_ATTACHED)
+                != events.cend();
+        });
+    }
+    setDefaultPcscBackend(systemPcscBackend());
+
+    EXPECT_NE(std::find(events.cbegin(), events.cend(), ReaderMonitor::Event::READER_ATTACHED),
+              events.cend());
+}
+
+TEST_F(CardEmulatorTest, readerMonitorReportsCardInsertionInReaderWithShortName)
+{
+    // A name short enough to be stored inline in string_t.
+#ifdef _WIN32
+    const string_t readerName = L"A";
+#else
+    const string_t readerName = "A";
+#endif
+    std::mutex mutex;
+    std::condition_variable eventReceived;
+    std::vector<ReaderMonitor::Event> events;
+
+    setDefaultPcscBackend(emulatedPcscBackend());
+    insertEmulatedCard(readerName, emulatedCard(SmartCard::Protocol::T1));
+    removeEmulatedCard(readerName);
+    {
+        const auto monitor = ReaderMonitor {[&](const ReaderMonitor::Event event, const Reader&) {
+            std::lock_guard<std::mutex> lock(mutex);
+            events.push_back(event);
+            eventReceived.notify_one();
+        }};
+        insertEmulatedCard(readerName, emulatedCard(SmartCard::Protocol::T1));
+
+        std::unique_lock<std::mutex> lock(mutex);
+        eventReceived.wait_for(lock, std::chrono::seconds(5), [&] {
+            return std::find(events.cbegin(), events.cend(), ReaderMonitor::Event::CARD_INSERTED)
+                != events.cend();
+        });
+    }
+    setDefaultPcscBackend(systemPcscBackend());
+
+    EXPECT_NE(std::find(events.cbegin(), events.cend(), ReaderMonitor::Event::READER_ATTACHED),
+              events.cend());
+    EXPECT_NE(std::find(events.cbegin(), events.cend(), ReaderMonitor::Event::CARD_INSERTED),
+              events.cend());
+}
+
+TEST_F(CardEmulatorTest, flightRecorderKeepsNonAsciiReaderName)
+{
+    // Characters beyond one byte, wide on Windows and UTF-8 elsewhere.
+#ifdef _WIN32
+    const string_t readerName = L"Lecteur \u00e9 \u20ac";
+#else
+    const string_t readerName = "Lecteur \xc3\xa9 \xe2\x82\xac";
+#endif
+    insertEmulatedCard(readerName, emulatedCard(SmartCard::Protocol::T1));
+    auto card = listReaders(establishContext(emulatedPcscBackend()))[0].connectToCard();
+    auto transactionGuard = card->beginTransaction();
+
+    card->transmit(CommandApdu {0x00, 0xa4, 0x00, 0x0c, {0x3f, 0x00}});
+
+    const auto records = flightRecorderSnapshot();
+    ASSERT_FALSE(records.empty());
+    EXPECT_EQ(records.back().reader, readerName);
+}
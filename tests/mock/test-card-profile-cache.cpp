@@ -0,0 +1,121 @@
+/*
+ * Copyright (c) 2020-2023 Estonian Information System Authority
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "pcsc-cpp/pcsc-cpp.hpp"
+
+#include "pcsc-mock/pcsc-mock.hpp"
+
+#include <gtest/gtest.h>
+
+#include <cstdio>
+#include <fstream>
+
+using namespace pcsc_cpp;
+
+namespace
+{
+
+std::string cacheFilePath()
+{
+    const auto path = testing::TempDir() + "pcsc-cpp-test-card-profile-cache";
+    std::remove(path.c_str());
+    return path;
+}
+
+} // namespace
+
+#ifndef _WIN32
+
+TEST(pcsc_cpp_test, cardProfileCacheIsSharedBetweenSessions)
+{
+    const auto path = cacheFilePath();
+    const auto readers = listReaders();
+    ASSERT_FALSE(readers.empty());
+    const auto& reader = readers[0];
+
+    {
+        auto cache = CardProfileCache {path};
+        EXPECT_FALSE(cache.find(reader));
+
+        auto card = reader.connectToCard();
+        card->setExtendedLengthSupported(true);
+        setReadBinaryBlockLength(reader.cardAtr, 0xe0);
+        cache.update(reader, *card);
+    }
+
+    auto cache = CardProfileCache {path};
+    auto card = reader.connectToCard();
+
+    EXPECT_TRUE(cache.apply(reader, *card));
+    EXPECT_TRUE(card->extendedLengthSupported());
+    EXPECT_EQ(readBinaryBlockLength(reader.cardAtr), 0xe0U);
+
+    setReadBinaryBlockLength(reader.cardAtr, 0);
+    std::remove(path.c_str());
+}
+
+TEST(pcsc_cpp_test, cardProfileCacheReinitializesInvalidFile)
+{
+    const auto path = cacheFilePath();
+    std::ofstream(path) << "not a card profile cache";
+
+    const auto readers = listReaders();
+    ASSERT_FALSE(readers.empty());
+
+    auto cache = CardProfileCache {path};
+    EXPECT_FALSE(cache.find(readers[0]));
+
+    cache.store(readers[0], {false, 0x80});
+    ASSERT_TRUE(cache.find(readers[0]));
+    EXPECT_EQ(cache.find(readers[0])->readBinaryBlockLength, 0x80U);
+
+    std::remove(path.c_str());
+}
+
+TEST(pcsc_cpp_test, cardProfileCacheSkipsInvalidEntries)
+{
+    const auto path = cacheFilePath();
+    const auto readers = listReaders();
+    ASSERT_FALSE(readers.empty());
+    const auto& reader = readers[0];
+
+    {
+        auto cache = CardProfileCache {path};
+        // Written by another process, the block length cannot be applied.
+        cache.store(reader, {true, 0x10000});
+        EXPECT_FALSE(cache.find(reader));
+    }
+
+    auto cache = CardProfileCache {path};
+    auto card = reader.connectToCard();
+
+    EXPECT_FALSE(cache.apply(reader, *card));
+    EXPECT_EQ(readBinaryBlockLength(reader.cardAtr), 0U);
+
+    cache.store(reader, {false, 0x80});
+    ASSERT_TRUE(cache.find(reader));
+    EXPECT_EQ(cache.find(reader)->readBinaryBlockLength, 0x80U);
+
+    std::remove(path.c_str());
+}
+
+#endif // _WIN32
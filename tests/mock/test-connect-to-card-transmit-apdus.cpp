@@ -27,11 +27,18 @@
 
 #include <gtest/gtest.h>
 
+#include <thread>
+
 using namespace pcsc_cpp;
 
 namespace
 {
 
+bool isSelectOrReadBinary(const CommandApdu& command)
+{
+    return command.ins == 0xa4 || command.ins == 0xb0;
+}
+
 SmartCard::ptr connectToCard()
 {
     auto readers = listReaders();
@@ -50,6 +57,17 @@ TEST(pcsc_cpp_test, connectToCardSuccess)
     EXPECT_EQ(card->protocol(), SmartCard::Protocol::T1);
 }
 
+TEST(pcsc_cpp_test, readerFeaturesAreSharedInContext)
+{
+    const auto ctx = establishContext();
+    const auto readers = listReaders(ctx);
+    ASSERT_EQ(readers.size(), 1U);
+
+    // The mock reader has no features, the second card uses the features cached in the context.
+    EXPECT_FALSE(readers[0].connectToCard()->readerHasPinPad());
+    EXPECT_FALSE(readers[0].connectToCard()->readerHasPinPad());
+}
+
 TEST(pcsc_cpp_test, transmitApduSuccess)
 {
     auto card = connectToCard();
@@ -62,3 +80,496 @@ TEST(pcsc_cpp_test, transmitApduSuccess)
 
     EXPECT_EQ(response.toBytes(), expectedResponse.toBytes());
 }
+
+TEST(pcsc_cpp_test, nestedTransactionGuardsShareOuterTransaction)
+{
+    auto card = connectToCard();
+    const auto command = CommandApdu::fromBytes(PcscMock::DEFAULT_COMMAND_APDU);
+
+    {
+        auto outerGuard = card->beginTransaction();
+
+        // Inner guards must not call SCardBeginTransaction() again.
+        PcscMock::addReturnValueForScardFunctionCall("SCardBeginTransaction",
+                                                     SCARD_E_NOT_TRANSACTED);
+        {
+            auto innerGuard = card->beginTransaction();
+            EXPECT_EQ(card->transmit(command).toBytes(), PcscMock::DEFAULT_RESPONSE_APDU);
+        }
+
+        // The inner guard has not ended the outer transaction.
+        EXPECT_EQ(card->transmit(command).toBytes(), PcscMock::DEFAULT_RESPONSE_APDU);
+    }
+
+    EXPECT_THROW(card->transmit(command), std::logic_error);
+
+    PcscMock::reset();
+}
+
+TEST(pcsc_cpp_test, transactionHoldReusesAndReleasesTransaction)
+{
+    using namespace std::chrono_literals;
+
+    auto card = connectToCard();
+    card->setTransactionHold(50ms, 1s);
+
+    { auto transactionGuard = card->beginTransaction(); }
+
+    // The held transaction is reused without SCardBeginTransaction().
+    PcscMock::addReturnValueForScardFunctionCall("SCardBeginTransaction", SCARD_E_NOT_TRANSACTED);
+    { auto transactionGuard = card->beginTransaction(); }
+
+    // The transaction is released after the idle time.
+    std::this_thread::sleep_for(200ms);
+    EXPECT_THROW(card->beginTransaction(), ScardTransactionFailedError);
+
+    PcscMock::reset();
+}
+
+TEST(pcsc_cpp_test, transmitIntoResponseBufferSuccess)
+{
+    auto card = connectToCard();
+
+    PcscMock::setApduScript({{{0x00, 0xb0, 0x00, 0x00, 0x04}, {0x01, 0x02, 0x61, 0x02}},
+                             {{0x00, 0xc0, 0x00, 0x00, 0x02}, {0x03, 0x04, 0x90, 0x00}}});
+
+    const auto commandBytes = byte_vector {0x00, 0xb0, 0x00, 0x00, 0x04};
+    auto responseBuffer = byte_vector(ResponseApdu::MAX_SIZE);
+
+    auto transactionGuard = card->beginTransaction();
+    auto response = card->transmit(commandBytes, responseBuffer);
+
+    EXPECT_TRUE(response.isOK());
+    EXPECT_EQ(response.data, responseBuffer.data());
+    EXPECT_EQ(byte_vector(response.data, response.data + response.dataSize),
+              (byte_vector {0x01, 0x02, 0x03, 0x04}));
+    EXPECT_EQ(responseBuffer.size(), ResponseApdu::MAX_SIZE);
+
+    PcscMock::reset();
+}
+
+TEST(pcsc_cpp_test, transmitApduCollectsMoreResponseData)
+{
+    auto card = connectToCard();
+
+    PcscMock::setApduScript({{{0x00, 0xb0, 0x00, 0x00, 0x00}, {0x01, 0x61, 0x02}},
+                             {{0x00, 0xc0, 0x00, 0x00, 0x02}, {0x02, 0x03, 0x61, 0x01}},
+                             {{0x00, 0xc0, 0x00, 0x00, 0x01}, {0x04, 0x90, 0x00}}});
+
+    auto transactionGuard = card->beginTransaction();
+    auto response = card->transmit(CommandApdu {0x00, 0xb0, 0x00, 0x00, {}, 256});
+
+    EXPECT_TRUE(response.isOK());
+    EXPECT_EQ(response.data, (byte_vector {0x01, 0x02, 0x03, 0x04}));
+
+    PcscMock::reset();
+}
+
+TEST(pcsc_cpp_test, transmitApduRetriesWithCorrectedLe)
+{
+    auto card = connectToCard();
+
+    PcscMock::setApduScript({{{0x00, 0xca, 0x01, 0x00, 0x00}, {0x6c, 0x03}},
+                             {{0x00, 0xca, 0x01, 0x00, 0x03}, {0x01, 0x02, 0x03, 0x90, 0x00}}});
+
+    auto transactionGuard = card->beginTransaction();
+    auto response = card->transmit(CommandApdu {0x00, 0xca, 0x01, 0x00, {}, 256});
+
+    EXPECT_TRUE(response.isOK());
+    EXPECT_EQ(response.data, (byte_vector {0x01, 0x02, 0x03}));
+
+    PcscMock::reset();
+}
+
+TEST(pcsc_cpp_test, transmitBatchStoresResponsesInArena)
+{
+    auto card = connectToCard();
+
+    PcscMock::setApduScript({{{0x00, 0xa4, 0x04, 0x00, 0x01, 0xaa}, {0x90, 0x00}},
+                             {{0x00, 0xb0, 0x00, 0x00, 0x00}, {0x01, 0x02, 0x61, 0x01}},
+                             {{0x00, 0xc0, 0x00, 0x00, 0x01}, {0x03, 0x90, 0x00}},
+                             {{0x00, 0xca, 0x01, 0x00, 0x00}, {0x04, 0x05, 0x90, 0x00}}});
+
+    const auto response =
+        card->transmitBatch({CommandApdu {0x00, 0xa4, 0x04, 0x00, {0xaa}},
+                             CommandApdu {0x00, 0xb0, 0x00, 0x00, {}, 256},
+                             CommandApdu {0x00, 0xca, 0x01, 0x00, {}, 256}});
+
+    ASSERT_EQ(response.size(), 3U);
+    EXPECT_EQ(response.arena, (byte_vector {0x01, 0x02, 0x03, 0x04, 0x05}));
+    EXPECT_EQ(response[0].dataSize, 0U);
+    EXPECT_EQ(response[1].toResponseApdu().data, (byte_vector {0x01, 0x02, 0x03}));
+    EXPECT_EQ(response[2].toResponseApdu().data, (byte_vector {0x04, 0x05}));
+    EXPECT_TRUE(response[2].isOK());
+
+    PcscMock::reset();
+}
+
+TEST(pcsc_cpp_test, transmitBatchStopsWhenPredicateFails)
+{
+    auto card = connectToCard();
+
+    PcscMock::setApduScript({{{0x00, 0xa4, 0x04, 0x00, 0x01, 0xaa}, {0x69, 0x82}}});
+
+    const auto response =
+        card->transmitBatch({CommandApdu {0x00, 0xa4, 0x04, 0x00, {0xaa}},
+                             CommandApdu {0x00, 0xb0, 0x00, 0x00, {}, 256}});
+
+    ASSERT_EQ(response.size(), 1U);
+    EXPECT_EQ(response[0].toSW(), 0x6982);
+
+    PcscMock::reset();
+}
+
+TEST(pcsc_cpp_test, readBinaryShrinksAndRemembersBlockLength)
+{
+    auto card = connectToCard();
+
+    auto firstBlock = byte_vector(100, 0x01);
+    firstBlock.insert(firstBlock.end(), {0x90, 0x00});
+    auto secondBlock = byte_vector(100, 0x02);
+    secondBlock.insert(secondBlock.end(), {0x90, 0x00});
+
+    PcscMock::setApduScript({{{0x00, 0xb0, 0x00, 0x00, 0xc8}, {0x67, 0x00}},
+                             {{0x00, 0xb0, 0x00, 0x00, 0x64}, firstBlock},
+                             {{0x00, 0xb0, 0x00, 0x64, 0x64}, secondBlock},
+                             // The second read starts with the remembered block length.
+                             {{0x00, 0xb0, 0x00, 0x00, 0x64}, firstBlock},
+                             {{0x00, 0xb0, 0x00, 0x64, 0x64}, secondBlock}});
+
+    auto transactionGuard = card->beginTransaction();
+
+    for (int i = 0; i < 2; ++i) {
+        const auto data = readBinary(*card, 200);
+
+        ASSERT_EQ(data.size(), 200U);
+        EXPECT_EQ(data[99], 0x01);
+        EXPECT_EQ(data[100], 0x02);
+    }
+
+    setReadBinaryBlockLength(card->atr(), 0);
+    PcscMock::reset();
+}
+
+TEST(pcsc_cpp_test, readBinaryShrinksExtendedBlockOnWrongLe)
+{
+    auto card = connectToCard();
+    card->setExtendedLengthSupported(true);
+
+    auto firstBlock = byte_vector(0x80, 0x01);
+    firstBlock.insert(firstBlock.end(), {0x90, 0x00});
+    auto secondBlock = byte_vector(0x80, 0x02);
+    secondBlock.insert(secondBlock.end(), {0x90, 0x00});
+    auto thirdBlock = byte_vector(0x40, 0x03);
+    thirdBlock.insert(thirdBlock.end(), {0x90, 0x00});
+
+    // The card corrects the extended Le with 0x6C, the command is resent with the short Le.
+    PcscMock::setApduScript({{{0x00, 0xb0, 0x00, 0x00, 0x00, 0x01, 0x40}, {0x6c, 0x80}},
+                             {{0x00, 0xb0, 0x00, 0x00, 0x80}, firstBlock},
+                             {{0x00, 0xb0, 0x00, 0x80, 0x80}, secondBlock},
+                             {{0x00, 0xb0, 0x01, 0x00, 0x40}, thirdBlock}});
+
+    auto transactionGuard = card->beginTransaction();
+    const auto data = readBinary(*card, 0x140);
+
+    ASSERT_EQ(data.size(), 0x140U);
+    EXPECT_EQ(data[0x7f], 0x01);
+    EXPECT_EQ(data[0x80], 0x02);
+    EXPECT_EQ(data[0x100], 0x03);
+    EXPECT_EQ(readBinaryBlockLength(card->atr()), 0x80U);
+
+    setReadBinaryBlockLength(card->atr(), 0);
+    PcscMock::reset();
+}
+
+TEST(pcsc_cpp_test, responseCacheIsOptIn)
+{
+    EXPECT_FALSE(ResponseCache().isIdempotent(CommandApdu {0x00, 0xa4, 0x08, 0x0c, {0xee, 0xee}}));
+    EXPECT_FALSE(ResponseCache().isIdempotent(CommandApdu {0x00, 0xb0, 0x00, 0x00, {}, 2}));
+}
+
+TEST(pcsc_cpp_test, responseCacheServesRepeatedReads)
+{
+    auto card = connectToCard();
+    auto cache = std::make_shared<ResponseCache>(isSelectOrReadBinary);
+    card->setResponseCache(cache, "serial");
+
+    // Each command is in the script once, a second transmit to the card would fail.
+    PcscMock::setApduScript(
+        {{{0x00, 0xa4, 0x08, 0x0c, 0x02, 0xee, 0xee}, {0x90, 0x00}},
+         {{0x00, 0xb0, 0x00, 0x00, 0x02}, {0x01, 0x02, 0x90, 0x00}},
+         // The cached SELECT is sent before the command that is not cached.
+         {{0x00, 0xa4, 0x08, 0x0c, 0x02, 0xee, 0xee}, {0x90, 0x00}},
+         {{0x00, 0xb0, 0x00, 0x02, 0x02}, {0x03, 0x04, 0x90, 0x00}}});
+
+    const auto select = CommandApdu {0x00, 0xa4, 0x08, 0x0c, {0xee, 0xee}};
+    const auto readBinary = CommandApdu {0x00, 0xb0, 0x00, 0x00, {}, 2};
+
+    auto transactionGuard = card->beginTransaction();
+
+    for (int i = 0; i < 2; ++i) {
+        EXPECT_TRUE(card->transmit(select).isOK());
+        EXPECT_EQ(card->transmit(readBinary).data, (byte_vector {0x01, 0x02}));
+    }
+    EXPECT_EQ(cache->size(), 2U);
+
+    EXPECT_EQ(card->transmit(CommandApdu {0x00, 0xb0, 0x00, 0x02, {}, 2}).data,
+              (byte_vector {0x03, 0x04}));
+
+    cache->invalidate(card->atr(), "serial");
+    EXPECT_EQ(cache->size(), 0U);
+
+    PcscMock::reset();
+}
+
+TEST(pcsc_cpp_test, responseCacheIsInvalidatedByWrite)
+{
+    auto card = connectToCard();
+    auto cache = std::make_shared<ResponseCache>(isSelectOrReadBinary);
+    card->setResponseCache(cache, "serial");
+
+    PcscMock::setApduScript(
+        {{{0x00, 0xa4, 0x08, 0x0c, 0x02, 0xee, 0xee}, {0x90, 0x00}},
+         {{0x00, 0xb0, 0x00, 0x00, 0x02}, {0x01, 0x02, 0x90, 0x00}},
+         {{0x00, 0xd6, 0x00, 0x00, 0x02, 0x05, 0x06}, {0x90, 0x00}},
+         // The read after the write goes to the card.
+         {{0x00, 0xa4, 0x08, 0x0c, 0x02, 0xee, 0xee}, {0x90, 0x00}},
+         {{0x00, 0xb0, 0x00, 0x00, 0x02}, {0x05, 0x06, 0x90, 0x00}}});
+
+    const auto select = CommandApdu {0x00, 0xa4, 0x08, 0x0c, {0xee, 0xee}};
+    const auto readBinary = CommandApdu {0x00, 0xb0, 0x00, 0x00, {}, 2};
+
+    auto transactionGuard = card->beginTransaction();
+
+    EXPECT_TRUE(card->transmit(select).isOK());
+    EXPECT_EQ(card->transmit(readBinary).data, (byte_vector {0x01, 0x02}));
+    EXPECT_TRUE(card->transmit(CommandApdu {0x00, 0xd6, 0x00, 0x00, {0x05, 0x06}}).isOK());
+    EXPECT_EQ(cache->size(), 0U);
+
+    EXPECT_TRUE(card->transmit(select).isOK());
+    EXPECT_EQ(card->transmit(readBinary).data, (byte_vector {0x05, 0x06}));
+
+    PcscMock::reset();
+}
+
+TEST(pcsc_cpp_test, responseCacheIsInvalidatedWhenCachedSelectFails)
+{
+    auto card = connectToCard();
+    auto cache = std::make_shared<ResponseCache>(isSelectOrReadBinary);
+    card->setResponseCache(cache, "serial");
+
+    PcscMock::setApduScript({{{0x00, 0xa4, 0x08, 0x0c, 0x02, 0xee, 0xee}, {0x90, 0x00}},
+                             {{0x00, 0xb0, 0x00, 0x00, 0x02}, {0x01, 0x02, 0x90, 0x00}},
+                             // The card was swapped, the cached SELECT fails.
+                             {{0x00, 0xa4, 0x08, 0x0c, 0x02, 0xee, 0xee}, {0x6a, 0x82}}});
+
+    const auto select = CommandApdu {0x00, 0xa4, 0x08, 0x0c, {0xee, 0xee}};
+
+    auto transactionGuard = card->beginTransaction();
+
+    EXPECT_TRUE(card->transmit(select).isOK());
+    EXPECT_TRUE(card->transmit(CommandApdu {0x00, 0xb0, 0x00, 0x00, {}, 2}).isOK());
+    EXPECT_EQ(cache->size(), 2U);
+
+    // Served from cache, the SELECT is sent with the next command.
+    EXPECT_TRUE(card->transmit(select).isOK());
+    EXPECT_THROW(card->transmit(CommandApdu {0x00, 0xb0, 0x00, 0x02, {}, 2}), Error);
+    EXPECT_EQ(cache->size(), 0U);
+
+    PcscMock::reset();
+}
+
+TEST(pcsc_cpp_test, transmitAsyncSuccess)
+{
+    auto card = connectToCard();
+    auto executor = TransmitExecutor {2, 1};
+
+    auto transactionGuard = card->beginTransaction();
+
+    auto responses = std::vector<std::future<ResponseApdu>> {};
+    for (int i = 0; i < 3; ++i) {
+        responses.push_back(
+            executor.transmitAsync(*card, CommandApdu::fromBytes(PcscMock::DEFAULT_COMMAND_APDU)));
+    }
+
+    for (auto& response : responses) {
+        EXPECT_EQ(response.get().toBytes(), PcscMock::DEFAULT_RESPONSE_APDU);
+    }
+}
+
+TEST(pcsc_cpp_test, transmitAsyncOutsideTransactionFails)
+{
+    auto card = connectToCard();
+    auto executor = TransmitExecutor {};
+
+    auto response =
+        executor.transmitAsync(*card, CommandApdu::fromBytes(PcscMock::DEFAULT_COMMAND_APDU));
+
+    EXPECT_THROW(response.get(), std::logic_error);
+}
+
+TEST(pcsc_cpp_test, cardConnectionPoolReusesConnectedCard)
+{
+    auto pool = CardConnectionPool {1};
+    const auto readers = listReaders();
+    ASSERT_EQ(readers.size(), 1U);
+
+    {
+        auto lease = pool.acquire(readers[0]);
+        // Mark the card to recognize it when it is reused.
+        lease->setExtendedLengthSupported(true);
+    }
+    EXPECT_EQ(pool.idleCount(), 1U);
+
+    auto lease = pool.acquire(readers[0]);
+    EXPECT_TRUE(lease->extendedLengthSupported());
+    EXPECT_EQ(pool.idleCount(), 0U);
+
+    auto transactionGuard = lease->beginTransaction();
+    EXPECT_EQ(lease->transmit(CommandApdu::fromBytes(PcscMock::DEFAULT_COMMAND_APDU)).toBytes(),
+              PcscMock::DEFAULT_RESPONSE_APDU);
+}
+
+TEST(pcsc_cpp_test, cardConnectionPoolEvictsRemovedCard)
+{
+    auto pool = CardConnectionPool {};
+    const auto readers = listReaders();
+    ASSERT_EQ(readers.size(), 1U);
+
+    {
+        auto lease = pool.acquire(readers[0]);
+        lease->setExtendedLengthSupported(true);
+    }
+
+    PcscMock::addReturnValueForScardFunctionCall("SCardStatus", SCARD_W_REMOVED_CARD);
+
+    auto lease = pool.acquire(readers[0]);
+    EXPECT_FALSE(lease->extendedLengthSupported());
+
+    lease.discard();
+    EXPECT_EQ(pool.idleCount(), 0U);
+
+    PcscMock::reset();
+}
+
+TEST(pcsc_cpp_test, apduTraceSinkReceivesExchange)
+{
+    struct RecordingSink : public ApduTraceSink
+    {
+        void onExchange(const ApduExchange& exchange) override
+        {
+            commands.emplace_back(exchange.command, exchange.command + exchange.commandSize);
+            responses.emplace_back(exchange.response, exchange.response + exchange.responseSize);
+        }
+        std::vector<byte_vector> commands;
+        std::vector<byte_vector> responses;
+    };
+    const auto sink = std::make_shared<RecordingSink>();
+    setApduTraceSink(sink);
+
+    auto card = listReaders()[0].connectToCard();
+    {
+        auto transactionGuard = card->beginTransaction();
+        card->transmit(CommandApdu::fromBytes(PcscMock::DEFAULT_COMMAND_APDU));
+    }
+    setApduTraceSink(nullptr);
+
+    ASSERT_EQ(sink->commands.size(), 1U);
+    EXPECT_EQ(sink->commands[0], PcscMock::DEFAULT_COMMAND_APDU);
+    EXPECT_EQ(sink->responses[0], PcscMock::DEFAULT_RESPONSE_APDU);
+
+    const auto records = flightRecorderSnapshot();
+    ASSERT_FALSE(records.empty());
+    EXPECT_EQ(records.back().command, PcscMock::DEFAULT_COMMAND_APDU);
+    EXPECT_EQ(records.back().response, PcscMock::DEFAULT_RESPONSE_APDU);
+}
+
+TEST(pcsc_cpp_test, flightRecorderIsDumpedOnTransmitError)
+{
+    auto card = listReaders()[0].connectToCard();
+    auto transactionGuard = card->beginTransaction();
+    card->transmit(CommandApdu::fromBytes(PcscMock::DEFAULT_COMMAND_APDU));
+
+    std::vector<ApduTraceRecord> dumped;
+    setFlightRecorderDumpHandler(
+        [&](const Error&, const std::vector<ApduTraceRecord>& lastExchanges) {
+            dumped = lastExchanges;
+        });
+    PcscMock::addReturnValueForScardFunctionCall("SCardTransmit", SCARD_E_NOT_READY);
+
+    EXPECT_THROW(card->transmit(CommandApdu::fromBytes(PcscMock::DEFAULT_COMMAND_APDU)),
+                 ScardCardCommunicationFailedError);
+
+    PcscMock::reset();
+    setFlightRecorderDumpHandler({});
+
+    ASSERT_GE(dumped.size(), 2U);
+    EXPECT_EQ(dumped[dumped.size() - 2].response, PcscMock::DEFAULT_RESPONSE_APDU);
+    // The failed exchange is recorded without response.
+    EXPECT_EQ(dumped.back().command, PcscMock::DEFAULT_COMMAND_APDU);
+    EXPECT_TRUE(dumped.back().response.empty());
+}
+
+#ifdef PCSC_CPP_METRICS
+
+TEST(pcsc_cpp_test, scardCallMetricsCountTransmitsByReader)
+{
+    resetSCardCallMetrics();
+
+    const auto readers = listReaders();
+    ASSERT_EQ(readers.size(), 1U);
+    auto card = readers[0].connectToCard();
+    {
+        auto transactionGuard = card->beginTransaction();
+        card->transmit(CommandApdu::fromBytes(PcscMock::DEFAULT_COMMAND_APDU));
+        card->transmit(CommandApdu::fromBytes(PcscMock::DEFAULT_COMMAND_APDU));
+    }
+
+    const auto metrics = scardCallMetrics();
+    const auto transmit = std::find_if(metrics.cbegin(), metrics.cend(), [&](const auto& m) {
+        return m.function == "SCardTransmit" && m.reader == readers[0].name;
+    });
+    ASSERT_NE(transmit, metrics.cend());
+    EXPECT_EQ(transmit->callCount, 2U);
+    EXPECT_TRUE(transmit->errorCounts.empty());
+
+    uint64_t histogramCount = 0;
+    for (const auto count : transmit->latencyHistogram) {
+        histogramCount += count;
+    }
+    EXPECT_EQ(histogramCount, 2U);
+    EXPECT_LE(transmit->percentileMicros(50), transmit->percentileMicros(99));
+}
+
+TEST(pcsc_cpp_test, scardCallMetricsCountReaderSnapshotCalls)
+{
+    auto snapshot = ReaderSnapshot {establishContext()};
+    resetSCardCallMetrics();
+
+    snapshot.refresh();
+
+    const auto metrics = scardCallMetrics();
+    for (const auto* function : {"SCardListReaders", "SCardGetStatusChange"}) {
+        const auto call = std::find_if(metrics.cbegin(), metrics.cend(),
+                                       [&](const auto& m) { return m.function == function; });
+        ASSERT_NE(call, metrics.cend()) << function;
+        EXPECT_GE(call->callCount, 1U) << function;
+    }
+}
+
+#endif // PCSC_CPP_METRICS
+
+TEST(pcsc_cpp_test, scardCallMetricsHistogramBuckets)
+{
+    EXPECT_EQ(SCardCallMetrics::bucketIndex(3), 3U);
+    EXPECT_EQ(SCardCallMetrics::bucketIndex(4), 4U);
+    EXPECT_EQ(SCardCallMetrics::bucketIndex(7), 7U);
+    EXPECT_EQ(SCardCallMetrics::bucketIndex(8), 8U);
+    EXPECT_EQ(SCardCallMetrics::bucketIndex(9), 8U);
+    EXPECT_EQ(SCardCallMetrics::bucketIndex(1000), SCardCallMetrics::bucketIndex(1023));
+
+    for (size_t bucket = 0; bucket < SCardCallMetrics::HISTOGRAM_BUCKET_COUNT; ++bucket) {
+        EXPECT_EQ(SCardCallMetrics::bucketIndex(SCardCallMetrics::bucketLowerBoundMicros(bucket)),
+                  bucket);
+    }
+}
@@ -0,0 +1,84 @@
+/*
+ * Copyright (c) 2020-2023 Estonian Information System Authority
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "pcsc-cpp/pcsc-cpp.hpp"
+
+#include "pcsc-mock/pcsc-mock.hpp"
+
+#include <gtest/gtest.h>
+
+using namespace pcsc_cpp;
+
+TEST(pcsc_cpp_test, parseAtrDecodesInterfaceAndHistoricalBytes)
+{
+    const auto info = parseAtr(PcscMock::DEFAULT_CARD_ATR);
+
+    EXPECT_EQ(info.convention, AtrInfo::Convention::DIRECT);
+    EXPECT_EQ(info.fi, 512);
+    EXPECT_EQ(info.fMaxKHz, 5000);
+    EXPECT_EQ(info.di, 32);
+    EXPECT_EQ(info.extraGuardTime, 0);
+    EXPECT_TRUE(info.t0Supported);
+    EXPECT_TRUE(info.t1Supported);
+    EXPECT_FALSE(info.specificMode);
+    EXPECT_EQ(info.ifsc, 0xfe);
+    EXPECT_EQ(info.bwi, 4);
+    EXPECT_EQ(info.cwi, 5);
+    EXPECT_EQ(info.historicalBytes.size(), 11U);
+    EXPECT_FALSE(info.hasCardCapabilities);
+}
+
+TEST(pcsc_cpp_test, parseAtrDecodesCardCapabilities)
+{
+    const auto info = parseAtr({0x3b, 0x85, 0x01, 0x80, 0x73, 0x00, 0x00, 0xc0, 0xb7});
+
+    EXPECT_FALSE(info.t0Supported);
+    EXPECT_TRUE(info.t1Supported);
+    EXPECT_EQ(info.fi, 372);
+    EXPECT_EQ(info.ifsc, 32);
+    EXPECT_TRUE(info.hasCardCapabilities);
+    EXPECT_TRUE(info.commandChainingSupported);
+    EXPECT_TRUE(info.extendedLengthSupported);
+}
+
+TEST(pcsc_cpp_test, parseAtrRequiresCheckByteForT15)
+{
+    // UICC that offers T=0 with T=15 global interface bytes, so TCK is present.
+    const auto info = parseAtr({0x3b, 0x9f, 0x96, 0x80, 0x1f, 0xc7, 0x80, 0x31, 0xe0, 0x73, 0xfe,
+                                0x21, 0x1b, 0x63, 0xf7, 0x00, 0x00, 0x83, 0x81, 0x05, 0x90, 0xb4});
+
+    EXPECT_TRUE(info.t0Supported);
+    EXPECT_FALSE(info.t1Supported);
+    EXPECT_EQ(info.fi, 512);
+    EXPECT_EQ(info.di, 32);
+    EXPECT_EQ(info.historicalBytes.size(), 15U);
+}
+
+TEST(pcsc_cpp_test, parseAtrRejectsMalformedAtr)
+{
+    // Wrong check byte.
+    EXPECT_THROW(parseAtr({0x3b, 0x85, 0x01, 0x80, 0x73, 0x00, 0x00, 0xc0, 0xb6}), Error);
+    // Truncated historical bytes.
+    EXPECT_THROW(parseAtr({0x3b, 0x05, 0x80, 0x73}), Error);
+    // Invalid TS.
+    EXPECT_THROW(parseAtr({0x3c, 0x00}), Error);
+}
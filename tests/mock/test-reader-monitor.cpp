@@ -0,0 +1,61 @@
+/*
+ * Copyright (c) 2020-2023 Estonian Information System Authority
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "pcsc-cpp/pcsc-cpp.hpp"
+
+#include "pcsc-mock/pcsc-mock.hpp"
+
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+
+using namespace pcsc_cpp;
+
+TEST(pcsc_cpp_test, readerMonitorReportsPresentReaderAndCard)
+{
+    std::mutex mutex;
+    std::condition_variable eventsReceived;
+    std::vector<ReaderMonitor::Event> events;
+    byte_vector insertedCardAtr;
+
+    {
+        ReaderMonitor monitor([&](ReaderMonitor::Event event, const Reader& reader) {
+            std::lock_guard<std::mutex> lock(mutex);
+            events.push_back(event);
+            if (event == ReaderMonitor::Event::CARD_INSERTED) {
+                insertedCardAtr = reader.cardAtr;
+            }
+            eventsReceived.notify_one();
+        });
+
+        std::unique_lock<std::mutex> lock(mutex);
+        EXPECT_TRUE(eventsReceived.wait_for(lock, std::chrono::seconds(5),
+                                            [&events] { return events.size() >= 2; }));
+    }
+
+    EXPECT_EQ(events,
+              (std::vector<ReaderMonitor::Event> {ReaderMonitor::Event::READER_ATTACHED,
+                                                  ReaderMonitor::Event::CARD_INSERTED}));
+    EXPECT_EQ(insertedCardAtr, PcscMock::DEFAULT_CARD_ATR);
+}
@@ -0,0 +1,122 @@
+/*
+ * Copyright (c) 2020-2023 Estonian Information System Authority
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "pcsc-cpp/pcsc-cpp.hpp"
+#include "pcsc-cpp/pcsc-backend.hpp"
+
+#include "pcsc-mock/pcsc-mock.hpp"
+
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <chrono>
+
+using namespace pcsc_cpp;
+
+namespace
+{
+
+#ifdef _WIN32
+const string_t EMULATED_READER_NAME = L"Emulated reader 0";
+#else
+const string_t EMULATED_READER_NAME = "Emulated reader 0";
+#endif
+
+std::atomic<int> failingBeginTransactions {0};
+
+LONG beginTransactionFailingFirst(SCARDHANDLE handle)
+{
+    if (failingBeginTransactions.fetch_sub(1) > 0) {
+        return LONG(SCARD_W_RESET_CARD);
+    }
+    return emulatedPcscBackend().BeginTransaction(handle);
+}
+
+} // namespace
+
+TEST(pcsc_cpp_test, readerWorkerPoolRunsJobsOnCard)
+{
+    auto readerNames = std::vector<string_t> {};
+    for (const auto& reader : listReaders()) {
+        readerNames.push_back(reader.name);
+    }
+
+    ReaderWorkerPool pool(readerNames);
+
+    auto response = pool.submit([](SmartCard& card) {
+        return card.transmit(CommandApdu::fromBytes(PcscMock::DEFAULT_COMMAND_APDU));
+    });
+    auto atr = pool.submit([](SmartCard& card) { return card.atr(); });
+
+    ASSERT_EQ(response.wait_for(std::chrono::seconds(5)), std::future_status::ready);
+    EXPECT_EQ(response.get().toBytes(), PcscMock::DEFAULT_RESPONSE_APDU);
+    EXPECT_EQ(atr.get(), PcscMock::DEFAULT_CARD_ATR);
+}
+
+TEST(pcsc_cpp_test, readerWorkerPoolForwardsJobErrors)
+{
+    ReaderWorkerPool pool({listReaders()[0].name});
+
+    auto result =
+        pool.submit([](SmartCard& /* card */) -> int { throw std::runtime_error("failed"); });
+
+    EXPECT_THROW(result.get(), std::runtime_error);
+}
+
+TEST(pcsc_cpp_test, readerWorkerPoolFailsJobsWhenWorkersStop)
+{
+    const auto readerName = listReaders()[0].name;
+    PcscMock::addReturnValueForScardFunctionCall("SCardGetStatusChange", SCARD_E_NO_SERVICE);
+    {
+        ReaderWorkerPool pool({readerName});
+
+        auto pending = pool.submit([](SmartCard& card) { return card.atr(); });
+        ASSERT_EQ(pending.wait_for(std::chrono::seconds(5)), std::future_status::ready);
+        EXPECT_THROW(pending.get(), ScardServiceNotRunningError);
+
+        auto submittedAfterStop = pool.submit([](SmartCard& card) { return card.atr(); });
+        ASSERT_EQ(submittedAfterStop.wait_for(std::chrono::seconds(5)),
+                  std::future_status::ready);
+        EXPECT_THROW(submittedAfterStop.get(), ScardServiceNotRunningError);
+    }
+    PcscMock::reset();
+}
+
+TEST(pcsc_cpp_test, readerWorkerPoolReconnectsAfterFailedTransaction)
+{
+    auto backend = emulatedPcscBackend();
+    backend.BeginTransaction = beginTransactionFailingFirst;
+    failingBeginTransactions = 1;
+    insertEmulatedCard(EMULATED_READER_NAME, EmulatedCard {});
+    setDefaultPcscBackend(backend);
+    {
+        // The card stays in the reader, so the worker must not wait for a reader state change.
+        ReaderWorkerPool pool({EMULATED_READER_NAME});
+
+        auto atr = pool.submit([](SmartCard& card) { return card.atr(); });
+
+        ASSERT_EQ(atr.wait_for(std::chrono::seconds(5)), std::future_status::ready);
+        EXPECT_EQ(atr.get(), EmulatedCard {}.atr);
+    }
+    setDefaultPcscBackend(systemPcscBackend());
+    removeEmulatedReaders();
+}
@@ -21,6 +21,7 @@
  */
 
 #include "pcsc-cpp/pcsc-cpp.hpp"
+#include "pcsc-cpp/pcsc-backend.hpp"
 
 #include "pcsc-mock/pcsc-mock.hpp"
 #include "pcsc-cpp/comp_winscard.hpp"
@@ -63,3 +64,141 @@ TEST(pcsc_cpp_test, listReadersNoService)
 
     PcscMock::reset();
 }
+
+TEST(pcsc_cpp_test, listReadersWithReusedContextSuccess)
+{
+    using namespace pcsc_cpp;
+
+    auto ctx = establishContext();
+
+    EXPECT_EQ(listReaders(ctx).size(), 1U);
+    EXPECT_EQ(listReaders(ctx).size(), 1U);
+}
+
+TEST(pcsc_cpp_test, listReadersReestablishesInvalidContext)
+{
+    using namespace pcsc_cpp;
+
+    auto ctx = establishContext();
+
+    PcscMock::addReturnValueForScardFunctionCall("SCardIsValidContext", SCARD_E_INVALID_HANDLE);
+
+    auto readers = listReaders(ctx);
+    EXPECT_EQ(readers.size(), 1U);
+
+    PcscMock::reset();
+}
+
+TEST(pcsc_cpp_test, readerSnapshotReportsOnlyChanges)
+{
+    using namespace pcsc_cpp;
+
+    auto snapshot = ReaderSnapshot {establishContext()};
+
+    auto diff = snapshot.refresh();
+    ASSERT_EQ(diff.added.size(), 1U);
+    EXPECT_TRUE(diff.added[0].isCardInserted());
+    EXPECT_TRUE(diff.removed.empty());
+    EXPECT_TRUE(diff.changed.empty());
+
+    EXPECT_TRUE(snapshot.refresh().empty());
+    EXPECT_EQ(snapshot.readers().size(), 1U);
+}
+
+TEST(pcsc_cpp_test, readerSnapshotWithoutReaders)
+{
+    using namespace pcsc_cpp;
+
+    PcscMock::addReturnValueForScardFunctionCall("SCardListReaders", SCARD_E_NO_READERS_AVAILABLE);
+
+    auto snapshot = ReaderSnapshot {establishContext()};
+
+    EXPECT_TRUE(snapshot.refresh().empty());
+    EXPECT_TRUE(snapshot.readers().empty());
+
+    PcscMock::reset();
+
+    // The reader is reported once it is attached.
+    EXPECT_EQ(snapshot.refresh().added.size(), 1U);
+}
+
+TEST(pcsc_cpp_test, readerSnapshotReportsRemovedReaders)
+{
+    using namespace pcsc_cpp;
+
+    auto snapshot = ReaderSnapshot {establishContext()};
+    EXPECT_EQ(snapshot.refresh().added.size(), 1U);
+
+    PcscMock::addReturnValueForScardFunctionCall("SCardListReaders", SCARD_E_NO_READERS_AVAILABLE);
+
+    const auto diff = snapshot.refresh();
+    ASSERT_EQ(diff.removed.size(), 1U);
+#ifdef _WIN32
+    EXPECT_EQ(diff.removed[0].name, L"PcscMock-reader");
+#else
+    EXPECT_EQ(diff.removed[0].name, "PcscMock-reader");
+#endif
+    EXPECT_TRUE(diff.added.empty());
+    EXPECT_TRUE(diff.changed.empty());
+    EXPECT_TRUE(snapshot.readers().empty());
+
+    PcscMock::reset();
+}
+
+TEST(pcsc_cpp_test, readerSnapshotReportsChangedReaders)
+{
+    using namespace pcsc_cpp;
+
+#ifdef _WIN32
+    const string_t readerName = L"Emulated reader 0";
+#else
+    const string_t readerName = "Emulated reader 0";
+#endif
+
+    insertEmulatedCard(readerName, EmulatedCard {});
+
+    auto snapshot = ReaderSnapshot {establishContext(emulatedPcscBackend())};
+    ASSERT_EQ(snapshot.refresh().added.size(), 1U);
+
+    removeEmulatedCard(readerName);
+
+    const auto diff = snapshot.refresh();
+    ASSERT_EQ(diff.changed.size(), 1U);
+    EXPECT_FALSE(diff.changed[0].isCardInserted());
+    EXPECT_TRUE(diff.added.empty());
+    EXPECT_TRUE(diff.removed.empty());
+    EXPECT_TRUE(snapshot.refresh().empty());
+
+    removeEmulatedReaders();
+}
+
+TEST(pcsc_cpp_test, readerSnapshotReportsReplacedReaderWithShortName)
+{
+    using namespace pcsc_cpp;
+
+    // Names short enough to be stored inline in string_t.
+#ifdef _WIN32
+    const string_t oldReaderName = L"A";
+    const string_t newReaderName = L"B";
+#else
+    const string_t oldReaderName = "A";
+    const string_t newReaderName = "B";
+#endif
+
+    insertEmulatedCard(oldReaderName, EmulatedCard {});
+
+    auto snapshot = ReaderSnapshot {establishContext(emulatedPcscBackend())};
+    ASSERT_EQ(snapshot.refresh().added.size(), 1U);
+
+    removeEmulatedReaders();
+    insertEmulatedCard(newReaderName, EmulatedCard {});
+
+    const auto diff = snapshot.refresh();
+    ASSERT_EQ(diff.added.size(), 1U);
+    EXPECT_EQ(diff.added[0].name, newReaderName);
+    ASSERT_EQ(diff.removed.size(), 1U);
+    EXPECT_EQ(diff.removed[0].name, oldReaderName);
+    EXPECT_TRUE(diff.changed.empty());
+
+    removeEmulatedReaders();
+}
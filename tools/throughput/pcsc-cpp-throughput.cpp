@@ -0,0 +1,592 @@
+/*
+ * Copyright (c) 2020-2023 Estonian Information System Authority
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+// pcsc-cpp-throughput runs APDU workloads against every reader with a card, or against emulated
+// readers, and reports latency percentiles and throughput per reader, protocol and workload.
+// Run with --help for the options.
+
+#include "pcsc-cpp/pcsc-cpp.hpp"
+#include "pcsc-cpp/pcsc-backend.hpp"
+
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <numeric>
+#include <sstream>
+
+using namespace pcsc_cpp;
+using namespace std::string_literals;
+
+namespace
+{
+
+using clock_type = std::chrono::steady_clock;
+
+constexpr auto USAGE = R"(Usage: pcsc-cpp-throughput [options]
+
+Runs APDU workloads against every reader that listReaders() returns with a card inserted, or
+against emulated readers with --emulate, and reports latency percentiles and throughput.
+
+Workloads:
+  select  SELECT storm, the --select command transmitted --iterations times
+  read    --select, then READ BINARY of --read-kb KiB once per --block-sizes entry, --passes times
+  mixed   the --script commands, --passes times
+
+Options:
+  --workloads=LIST       comma-separated workloads to run (default: select,read,mixed)
+  --select=HEX           SELECT command APDU (default: 00a4080c0450005001, path 3F00/5000/5001)
+  --iterations=N         SELECT storm length (default: 200)
+  --read-kb=N            KiB to read per READ BINARY pass, at most 32 (default: 4)
+  --block-sizes=LIST     comma-separated READ BINARY block sizes (default: 128,223,255)
+                         sizes above 256 enable extended length APDUs
+  --passes=N             READ BINARY and mixed script passes (default: 5)
+  --script=FILE          mixed script, one hex command APDU per line, # starts a comment
+                         (default: SELECT and READ BINARY of two block sizes)
+  --json=FILE            write the results as JSON to FILE, - for standard output, the
+                         table is then written to standard error
+  --emulate              use emulated T=0 and T=1 readers instead of the PC/SC service
+  --emulated-baud=N      emulated transfer rate in bits per second, 0 for none (default: 0)
+  --emulated-overhead-us=N
+                         emulated fixed latency of every APDU in microseconds (default: 0)
+  --help                 show this help
+)";
+
+struct Options
+{
+    std::vector<std::string> workloads {"select", "read", "mixed"};
+    byte_vector select {0x00, 0xa4, 0x08, 0x0c, 0x04, 0x50, 0x00, 0x50, 0x01};
+    size_t iterations = 200;
+    size_t readKilobytes = 4;
+    std::vector<size_t> blockSizes {128, 223, 255};
+    size_t passes = 5;
+    std::vector<byte_vector> script;
+    std::string jsonFile;
+    bool emulate = false;
+    uint32_t emulatedBaudRate = 0;
+    std::chrono::microseconds emulatedOverhead {0};
+};
+
+struct WorkloadResult
+{
+    std::string reader;
+    std::string protocol;
+    std::string atr;
+    std::string workload;
+    size_t blockSize = 0;
+    std::vector<double> latenciesUs;
+    size_t errors = 0;
+    // Serialized command APDUs and response data.
+    size_t bytesSent = 0;
+    size_t bytesReceived = 0;
+    double seconds = 0;
+};
+
+byte_vector hexToBytes(const std::string& hex)
+{
+    auto digits = std::string {};
+    std::copy_if(hex.cbegin(), hex.cend(), std::back_inserter(digits),
+                 [](const char c) { return !std::isspace(static_cast<unsigned char>(c)); });
+    if (digits.size() % 2 != 0
+        || digits.find_first_not_of("0123456789abcdefABCDEF") != std::string::npos) {
+        throw std::invalid_argument("Invalid hex string: '" + hex + "'");
+    }
+    auto result = byte_vector {};
+    for (size_t i = 0; i < digits.size(); i += 2) {
+        result.push_back(byte_type(std::stoul(digits.substr(i, 2), nullptr, 16)));
+    }
+    return result;
+}
+
+/** Parse a command APDU, short commands have Le if their length says so (case 2 and 4). */
+CommandApdu parseCommand(const byte_vector& bytes)
+{
+    const auto hasLe = bytes.size() == 5
+        || (bytes.size() > 5 && bytes[4] != 0x00 && bytes.size() == size_t(bytes[4]) + 6);
+    return CommandApdu::fromBytes(bytes, hasLe);
+}
+
+std::vector<std::string> split(const std::string& list)
+{
+    auto result = std::vector<std::string> {};
+    auto stream = std::istringstream(list);
+    for (std::string item; std::getline(stream, item, ',');) {
+        if (!item.empty()) {
+            result.push_back(item);
+        }
+    }
+    return result;
+}
+
+size_t toSize(const std::string& value, const size_t min, const size_t max)
+{
+    size_t parsed = 0;
+    const auto number = std::stoull(value, &parsed);
+    if (parsed != value.size() || number < min || number > max) {
+        throw std::invalid_argument("Value '" + value + "' is not in range " + std::to_string(min)
+                                    + ".." + std::to_string(max));
+    }
+    return size_t(number);
+}
+
+std::vector<byte_vector> loadScript(const std::string& fileName)
+{
+    auto file = std::ifstream(fileName);
+    if (!file) {
+        throw std::invalid_argument("Cannot open script file '" + fileName + "'");
+    }
+    auto result = std::vector<byte_vector> {};
+    for (std::string line; std::getline(file, line);) {
+        line = line.substr(0, line.find('#'));
+        if (line.find_first_not_of(" \t\r") != std::string::npos) {
+            result.push_back(hexToBytes(line));
+        }
+    }
+    if (result.empty()) {
+        throw std::invalid_argument("Script file '" + fileName + "' has no commands");
+    }
+    return result;
+}
+
+Options parseOptions(int argc, char** argv)
+{
+    auto options = Options {};
+    auto scriptFile = std::string {};
+
+    for (auto i = 1; i < argc; ++i) {
+        const auto arg = std::string(argv[i]);
+        const auto separator = arg.find('=');
+        const auto name = arg.substr(0, separator);
+        const auto value = separator == std::string::npos ? ""s : arg.substr(separator + 1);
+
+        if (name == "--help") {
+            std::cout << USAGE;
+            std::exit(0);
+        } else if (name == "--workloads") {
+            options.workloads = split(value);
+            for (const auto& workload : options.workloads) {
+                if (workload != "select" && workload != "read" && workload != "mixed") {
+                    throw std::invalid_argument("Unknown workload '" + workload + "'");
+                }
+            }
+        } else if (name == "--select") {
+            options.select = hexToBytes(value);
+        } else if (name == "--iterations") {
+            options.iterations = toSize(value, 1, 10000000);
+        } else if (name == "--read-kb") {
+            // READ BINARY offsets in P1-P2 are limited to 15 bits.
+            options.readKilobytes = toSize(value, 1, 32);
+        } else if (name == "--block-sizes") {
+            options.blockSizes.clear();
+            for (const auto& blockSize : split(value)) {
+                options.blockSizes.push_back(
+                    toSize(blockSize, 1, CommandApdu::MAX_EXTENDED_DATA_SIZE));
+            }
+        } else if (name == "--passes") {
+            options.passes = toSize(value, 1, 1000000);
+        } else if (name == "--script") {
+            scriptFile = value;
+        } else if (name == "--json") {
+            options.jsonFile = value;
+        } else if (name == "--emulate") {
+            options.emulate = true;
+        } else if (name == "--emulated-baud") {
+            options.emulatedBaudRate = uint32_t(toSize(value, 0, 10000000));
+        } else if (name == "--emulated-overhead-us") {
+            options.emulatedOverhead = std::chrono::microseconds(toSize(value, 0, 10000000));
+        } else {
+            throw std::invalid_argument("Unknown option '" + arg + "', see --help");
+        }
+    }
+
+    if (options.blockSizes.empty()) {
+        throw std::invalid_argument("--block-sizes must not be empty");
+    }
+    // Validate the commands early instead of failing in the middle of a run.
+    parseCommand(options.select);
+    if (scriptFile.empty()) {
+        options.script = {options.select,
+                          {0x00, 0xb0, 0x00, 0x00, 0x80},
+                          options.select,
+                          {0x00, 0xb0, 0x01, 0x00, 0xff}};
+    } else {
+        options.script = loadScript(scriptFile);
+        for (const auto& command : options.script) {
+            parseCommand(command);
+        }
+    }
+    return options;
+}
+
+/** Inserts a T=0 and a T=1 card with the transparent file 3F00/5000/5001 into the emulator. */
+void insertEmulatedCards(const Options& options)
+{
+    auto content = byte_vector(std::max(options.readKilobytes * 1024, size_t(0x200)));
+    for (size_t i = 0; i < content.size(); ++i) {
+        content[i] = byte_type(i);
+    }
+
+    for (const auto protocol : {SmartCard::Protocol::T0, SmartCard::Protocol::T1}) {
+        auto card = EmulatedCard {};
+        card.protocol = protocol;
+        if (protocol == SmartCard::Protocol::T0) {
+            card.atr = {0x3b, 0x00};
+        }
+        card.extendedLengthSupported = protocol == SmartCard::Protocol::T1;
+        card.baudRate = options.emulatedBaudRate;
+        card.apduOverhead = options.emulatedOverhead;
+        card.masterFile = EmulatedFile::dedicated(
+            0x3f00, {EmulatedFile::dedicated(0x5000, {EmulatedFile::elementary(0x5001, content)})});
+        const auto name = protocol == SmartCard::Protocol::T0 ? "Emulated T=0 reader"
+                                                              : "Emulated T=1 reader";
+        insertEmulatedCard(string_t(name, name + std::strlen(name)), card);
+    }
+}
+
+std::string narrow(const string_t& name)
+{
+    // Reader names are ASCII in practice, the same simplification as in the integration tests.
+    return std::string(name.cbegin(), name.cend());
+}
+
+std::string protocolName(const SmartCard::Protocol protocol)
+{
+    switch (protocol) {
+    case SmartCard::Protocol::T0:
+        return "T=0";
+    case SmartCard::Protocol::T1:
+        return "T=1";
+    default:
+        return "undefined";
+    }
+}
+
+/** Transmits the command, records its latency and returns false if the card did not return OK. */
+bool timedTransmit(const SmartCard& card, const CommandApdu& command, WorkloadResult& result,
+                   ResponseApdu* response = nullptr)
+{
+    const auto start = clock_type::now();
+    auto received = card.transmit(command);
+    const auto latency = clock_type::now() - start;
+
+    result.latenciesUs.push_back(std::chrono::duration<double, std::micro>(latency).count());
+    result.bytesSent += command.toBytes().size();
+    result.bytesReceived += received.data.size();
+    const auto ok = received.isOK();
+    if (!ok) {
+        ++result.errors;
+    }
+    if (response) {
+        *response = std::move(received);
+    }
+    return ok;
+}
+
+template <typename Workload>
+WorkloadResult runWorkload(SmartCard& card, WorkloadResult result, Workload workload)
+{
+    auto transactionGuard = card.beginTransaction();
+    const auto start = clock_type::now();
+    workload(result);
+    result.seconds = std::chrono::duration<double>(clock_type::now() - start).count();
+    return result;
+}
+
+void runSelectStorm(SmartCard& card, const Options& options, const WorkloadResult& base,
+                    std::vector<WorkloadResult>& results)
+{
+    auto result = base;
+    result.workload = "select";
+    const auto select = parseCommand(options.select);
+    results.push_back(runWorkload(card, result, [&](WorkloadResult& r) {
+        for (size_t i = 0; i < options.iterations; ++i) {
+            timedTransmit(card, select, r);
+        }
+    }));
+}
+
+void runReadBinary(SmartCard& card, const Options& options, const WorkloadResult& base,
+                   std::vector<WorkloadResult>& results)
+{
+    const auto select = parseCommand(options.select);
+    const auto length = options.readKilobytes * 1024;
+
+    for (const auto blockSize : options.blockSizes) {
+        auto result = base;
+        result.workload = "read";
+        result.blockSize = blockSize;
+        results.push_back(runWorkload(card, result, [&](WorkloadResult& r) {
+            if (!card.transmit(select).isOK()) {
+                ++r.errors;
+                return;
+            }
+            auto response = ResponseApdu {};
+            for (size_t pass = 0; pass < options.passes; ++pass) {
+                for (size_t offset = 0; offset < length;) {
+                    const auto le = std::min(blockSize, length - offset);
+                    const auto readBinary = CommandApdu {0x00,
+                                                         0xb0,
+                                                         byte_type(offset >> 8),
+                                                         byte_type(offset),
+                                                         {},
+                                                         static_cast<unsigned short>(le)};
+                    // Stop the pass at the end of file or on any other error.
+                    if (!timedTransmit(card, readBinary, r, &response) || response.data.empty()) {
+                        break;
+                    }
+                    offset += response.data.size();
+                }
+            }
+        }));
+    }
+}
+
+void runMixedScript(SmartCard& card, const Options& options, const WorkloadResult& base,
+                    std::vector<WorkloadResult>& results)
+{
+    auto commands = std::vector<CommandApdu> {};
+    for (const auto& command : options.script) {
+        commands.push_back(parseCommand(command));
+    }
+
+    auto result = base;
+    result.workload = "mixed";
+    results.push_back(runWorkload(card, result, [&](WorkloadResult& r) {
+        for (size_t pass = 0; pass < options.passes; ++pass) {
+            for (const auto& command : commands) {
+                timedTransmit(card, command, r);
+            }
+        }
+    }));
+}
+
+double percentile(const std::vector<double>& sorted, const double p)
+{
+    if (sorted.empty()) {
+        return 0;
+    }
+    // Nearest-rank percentile.
+    const auto rank = size_t(std::ceil(p / 100 * double(sorted.size())));
+    return sorted[std::max(rank, size_t(1)) - 1];
+}
+
+struct Summary
+{
+    double p50, p95, p99, max, mean;
+    double apdusPerSecond, bytesPerSecond;
+};
+
+Summary summarize(const WorkloadResult& result)
+{
+    auto sorted = result.latenciesUs;
+    std::sort(sorted.begin(), sorted.end());
+    const auto count = double(sorted.size());
+    const auto total = std::accumulate(sorted.cbegin(), sorted.cend(), 0.0);
+    const auto seconds = result.seconds > 0 ? result.seconds : 1;
+    return {percentile(sorted, 50),
+            percentile(sorted, 95),
+            percentile(sorted, 99),
+            sorted.empty() ? 0 : sorted.back(),
+            sorted.empty() ? 0 : total / count,
+            count / seconds,
+            double(result.bytesSent + result.bytesReceived) / seconds};
+}
+
+void printTable(std::ostream& out, const std::vector<WorkloadResult>& results)
+{
+    out << std::left << std::setw(28) << "reader" << std::setw(10) << "protocol" << std::setw(8)
+        << "workload" << std::right << std::setw(7) << "block" << std::setw(8) << "APDUs"
+        << std::setw(7) << "errors" << std::setw(10) << "p50 us" << std::setw(10) << "p95 us"
+        << std::setw(10) << "p99 us" << std::setw(10) << "APDU/s" << std::setw(12) << "bytes/s"
+        << '\n';
+    out << std::fixed << std::setprecision(1);
+    for (const auto& result : results) {
+        const auto summary = summarize(result);
+        out << std::left << std::setw(28) << result.reader.substr(0, 27) << std::setw(10)
+            << result.protocol << std::setw(8) << result.workload << std::right << std::setw(7)
+            << (result.blockSize ? std::to_string(result.blockSize) : "-"s) << std::setw(8)
+            << result.latenciesUs.size() << std::setw(7) << result.errors << std::setw(10)
+            << summary.p50 << std::setw(10) << summary.p95 << std::setw(10) << summary.p99
+            << std::setw(10) << summary.apdusPerSecond << std::setw(12) << summary.bytesPerSecond
+            << '\n';
+    }
+}
+
+std::string jsonString(const std::string& value)
+{
+    auto result = "\""s;
+    for (const auto c : value) {
+        if (c == '"' || c == '\\') {
+            result += '\\';
+            result += c;
+        } else if (static_cast<unsigned char>(c) < 0x20) {
+            std::ostringstream escaped;
+            escaped << "\\u" << std::hex << std::setw(4) << std::setfill('0') << int(c);
+            result += escaped.str();
+        } else {
+            result += c;
+        }
+    }
+    return result + '"';
+}
+
+std::string utcTimestamp()
+{
+    const auto now = std::time(nullptr);
+    std::tm utc {};
+#ifdef _WIN32
+    gmtime_s(&utc, &now);
+#else
+    gmtime_r(&now, &utc);
+#endif
+    std::ostringstream result;
+    result << std::put_time(&utc, "%Y-%m-%dT%H:%M:%SZ");
+    return result.str();
+}
+
+void writeJson(std::ostream& out, const Options& options,
+               const std::vector<WorkloadResult>& results)
+{
+    out << std::fixed << std::setprecision(1);
+    out << "{\n";
+    out << "  \"tool\": \"pcsc-cpp-throughput\",\n";
+    out << "  \"timestamp\": " << jsonString(utcTimestamp()) << ",\n";
+    out << "  \"emulated\": " << (options.emulate ? "true" : "false") << ",\n";
+    out << "  \"parameters\": {\"iterations\": " << options.iterations
+        << ", \"readKilobytes\": " << options.readKilobytes << ", \"passes\": " << options.passes
+        << ", \"select\": " << jsonString(bytes2hexstr(options.select)) << "},\n";
+    out << "  \"results\": [";
+    for (size_t i = 0; i < results.size(); ++i) {
+        const auto& result = results[i];
+        const auto summary = summarize(result);
+        out << (i ? ",\n" : "\n");
+        out << "    {\"reader\": " << jsonString(result.reader)
+            << ", \"protocol\": " << jsonString(result.protocol)
+            << ", \"atr\": " << jsonString(result.atr)
+            << ", \"workload\": " << jsonString(result.workload)
+            << ", \"blockSize\": " << result.blockSize << ",\n"
+            << "     \"apdus\": " << result.latenciesUs.size() << ", \"errors\": " << result.errors
+            << ", \"bytesSent\": " << result.bytesSent
+            << ", \"bytesReceived\": " << result.bytesReceived
+            << ", \"seconds\": " << std::setprecision(6) << result.seconds
+            << std::setprecision(1) << ",\n"
+            << "     \"latencyUs\": {\"p50\": " << summary.p50 << ", \"p95\": " << summary.p95
+            << ", \"p99\": " << summary.p99 << ", \"max\": " << summary.max
+            << ", \"mean\": " << summary.mean << "},\n"
+            << "     \"apdusPerSecond\": " << summary.apdusPerSecond
+            << ", \"bytesPerSecond\": " << summary.bytesPerSecond << "}";
+    }
+    out << "\n  ]\n}\n";
+}
+
+std::vector<WorkloadResult> runReader(const Reader& reader, const Options& options)
+{
+    auto results = std::vector<WorkloadResult> {};
+    const auto card = reader.connectToCard();
+    if (std::any_of(options.blockSizes.cbegin(), options.blockSizes.cend(),
+                    [](const size_t size) { return size > ResponseApdu::MAX_DATA_SIZE; })) {
+        card->setExtendedLengthSupported(true);
+    }
+
+    auto base = WorkloadResult {};
+    base.reader = narrow(reader.name);
+    base.protocol = protocolName(card->protocol());
+    base.atr = bytes2hexstr(card->atr());
+
+    for (const auto& workload : options.workloads) {
+        if (workload == "select") {
+            runSelectStorm(*card, options, base, results);
+        } else if (workload == "read") {
+            runReadBinary(*card, options, base, results);
+        } else {
+            runMixedScript(*card, options, base, results);
+        }
+    }
+    return results;
+}
+
+} // namespace
+
+int main(int argc, char** argv)
+{
+    auto options = Options {};
+    try {
+        options = parseOptions(argc, argv);
+    } catch (const std::exception& e) {
+        std::cerr << "Error: " << e.what() << '\n';
+        return 2;
+    }
+
+    auto exitCode = 0;
+    auto results = std::vector<WorkloadResult> {};
+    try {
+        if (options.emulate) {
+            insertEmulatedCards(options);
+        }
+        const auto readers = options.emulate ? listReaders(establishContext(emulatedPcscBackend()))
+                                             : listReaders();
+
+        for (const auto& reader : readers) {
+            if (!reader.isCardInserted()) {
+                std::cerr << "Skipping reader without card: " << narrow(reader.name) << '\n';
+                continue;
+            }
+            try {
+                const auto readerResults = runReader(reader, options);
+                results.insert(results.end(), readerResults.cbegin(), readerResults.cend());
+            } catch (const Error& e) {
+                std::cerr << "Reader " << narrow(reader.name) << " failed: " << e.what() << '\n';
+                exitCode = 1;
+            }
+        }
+    } catch (const Error& e) {
+        std::cerr << "Error: " << e.what() << '\n';
+        return 1;
+    }
+
+    if (results.empty()) {
+        std::cerr << "No readers with a card, nothing was measured\n";
+        return 1;
+    }
+
+    // Keep standard output valid JSON when the JSON goes there.
+    printTable(options.jsonFile == "-" ? std::cerr : std::cout, results);
+
+    if (options.jsonFile == "-") {
+        writeJson(std::cout, options, results);
+    } else if (!options.jsonFile.empty()) {
+        auto out = std::ofstream(options.jsonFile);
+        writeJson(out, options, results);
+        if (!out) {
+            std::cerr << "Cannot write " << options.jsonFile << '\n';
+            return 1;
+        }
+    }
+
+    return exitCode;
+}